@@ -0,0 +1,298 @@
+/******************************************************************************
+* File:        gencorpus.c
+* Date:        04-27-26
+*
+* Description: Lexer project
+*
+* Notes: Synthetic BCPL corpus generator for the benchmarks. Writes lines
+*        of BCPL-looking source until the requested size is reached. The
+*        mix decides which kind of token dominates so a single hot path can
+*        be measured on its own, "mixed" is a blend that looks like normal
+*        code. Output is the same for the same seed, mix and size.
+*
+*        usage: gencorpus [-m mix] [-s size] [-r seed] [-o file]
+*          -m  ident, comment, numeric, string or mixed (default mixed)
+*          -s  bytes to write, K/M/G suffixes allowed (default 1M)
+*          -r  random seed (default 1)
+*          -o  output file (default stdout)
+******************************************************************************/
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    MIX_IDENT,
+    MIX_COMMENT,
+    MIX_NUMERIC,
+    MIX_STRING,
+    MIX_MIXED,
+    MIX_COUNT
+} Mix;
+
+static const char *mixNames[MIX_COUNT] = { "ident", "comment", "numeric", "string", "mixed" };
+
+/*
+ * Relative weight of every kind of line for each mix, in the order
+ * identifier statement, comment, numeric statement, string statement.
+ */
+static const unsigned mixWeights[MIX_COUNT][4] = {
+    { 85,  5,  5,  5 },
+    {  5, 85,  5,  5 },
+    {  5,  5, 85,  5 },
+    {  5,  5,  5, 85 },
+    { 45, 20, 20, 15 },
+};
+
+static const char *keywords[] = {
+    "LET", "IF", "THEN", "ELSE", "UNLESS", "RESULTIS", "VALOF", "FOR", "TO",
+    "BY", "DO", "WHILE", "UNTIL", "TEST", "RETURN", "GLOBAL", "MANIFEST"
+};
+
+static const char *operators[] = {
+    "+", "-", "*", "/", ":=", "<=", ">=", "~=", "=", "<<", ">>", "->", "!", "@"
+};
+
+/* ============================================================
+   ========================== OUTPUT ==========================
+   ============================================================ */
+
+/* one line is built here and written in one go so its size is known */
+static char line[4096];
+static size_t lineLen;
+
+static void emitc(char c)
+{
+	if (lineLen < sizeof(line))
+		line[lineLen++] = c;
+}
+
+static void emit(const char *s)
+{
+	while (*s)
+		emitc(*s++);
+}
+
+static void emitf(const char *fmt, ...)
+{
+	char tmp[128];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(tmp, sizeof(tmp), fmt, ap);
+	va_end(ap);
+	emit(tmp);
+}
+
+static uint64_t rngState;
+
+/* xorshift64*, plenty for shuffling token kinds */
+static uint64_t rnd(void)
+{
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+	return rngState * 2685821657736338717ULL;
+}
+
+static unsigned below(unsigned n)
+{
+	return (unsigned)(rnd() % n);
+}
+
+static void putIdent(void)
+{
+	static const char first[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+	static const char rest[] = "abcdefghijklmnopqrstuvwxyz0123456789_";
+	unsigned len = 1 + below(4) + below(12);
+
+	emitc(first[below(sizeof(first) - 1)]);
+	while (--len)
+		emitc(rest[below(sizeof(rest) - 1)]);
+}
+
+static void putNumber(void)
+{
+	unsigned digits = 1 + below(12);
+
+	switch (below(5)) {
+	case 0:
+		emitf("0x%llX", (unsigned long long)(rnd() >> below(60)));
+		break;
+	case 1:
+		emit("0b");
+		while (digits--)
+			emitc('0' + below(2));
+		break;
+	case 2:
+		emitf("0o%llo", (unsigned long long)(rnd() >> below(60)));
+		break;
+	case 3:
+		/* no leading 0 before the '.', the lexer reads "0." as a prefix */
+		emitf("%u.%u", 1 + below(9999), below(100000));
+		break;
+	default:
+		emitc('1' + below(9));
+		while (--digits)
+			emitc('0' + below(10));
+		break;
+	}
+}
+
+static void putString(void)
+{
+	static const char body[] = "abcdefghij klmnopqrst uvwxyz ABC 0123456789 .,;:!?";
+	static const char *escapes[] = { "\\t", "\\r", "\\\"", "\\\\" };
+	unsigned len = below(60);
+
+	if (below(4) == 0) {
+		emitf("'%c'", 'a' + below(26));
+		return;
+	}
+
+	emitc('"');
+	emitc('x');
+	while (len--) {
+		if (below(24) == 0)
+			emit(escapes[below(4)]);
+		else
+			emitc(body[below(sizeof(body) - 1)]);
+	}
+	emitc('"');
+}
+
+/* ============================================================
+   =========================== LINES ==========================
+   ============================================================ */
+
+/*
+ * "LET name := value op value op ..." with value made by putValue.
+ */
+static void putStatement(void (*putValue)(void))
+{
+	unsigned terms = 1 + below(5);
+
+	emitf("%s ", keywords[below(sizeof(keywords) / sizeof(keywords[0]))]);
+	putIdent();
+	emit(" := ");
+	putValue();
+	while (--terms) {
+		emitf(" %s ", operators[below(sizeof(operators) / sizeof(operators[0]))]);
+		putValue();
+	}
+	emit(below(3) ? "\n" : ";\n");
+}
+
+static void putComment(void)
+{
+	static const char words[] = "the quick brown fox jumps over the lazy dog 0123456789 ";
+	unsigned len = 20 + below(60);
+
+	if (below(3) == 0) {
+		unsigned lines = 1 + below(4);
+
+		emit("/*");
+		while (lines--) {
+			for (unsigned i = 0; i < len; i++)
+				emitc(words[below(sizeof(words) - 1)]);
+			emitc('\n');
+		}
+		emit("*/\n");
+		return;
+	}
+
+	emit("// ");
+	while (len--)
+		emitc(words[below(sizeof(words) - 1)]);
+	emitc('\n');
+}
+
+static void putLine(Mix mix)
+{
+	const unsigned *w = mixWeights[mix];
+	unsigned pick = below(w[0] + w[1] + w[2] + w[3]);
+
+	/* a little indentation so whitespace runs aren't all one byte */
+	if (below(2))
+		emit(below(2) ? "    " : "\t");
+
+	if (pick < w[0])
+		putStatement(putIdent);
+	else if ((pick -= w[0]) < w[1])
+		putComment();
+	else if ((pick -= w[1]) < w[2])
+		putStatement(putNumber);
+	else
+		putStatement(putString);
+}
+
+/* ============================================================
+   =========================== MAIN ===========================
+   ============================================================ */
+
+static unsigned long long parseSize(const char *text)
+{
+	char *end;
+	unsigned long long n = strtoull(text, &end, 10);
+
+	switch (*end) {
+	case 'k': case 'K': n <<= 10; break;
+	case 'm': case 'M': n <<= 20; break;
+	case 'g': case 'G': n <<= 30; break;
+	default: break;
+	}
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	Mix mix = MIX_MIXED;
+	unsigned long long size = 1 << 20;
+	const char *path = NULL;
+	FILE *out = stdout;
+	int i;
+
+	rngState = 1;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			const char *name = argv[++i];
+
+			for (mix = 0; mix < MIX_COUNT && strcmp(mixNames[mix], name) != 0; mix++)
+				;
+			if (mix == MIX_COUNT) {
+				fprintf(stderr, "gencorpus: unknown mix %s\n", name);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			size = parseSize(argv[++i]);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			rngState = strtoull(argv[++i], NULL, 10) * 0x9E3779B97F4A7C15ULL + 1;
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			path = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [-m ident|comment|numeric|string|mixed] [-s size] [-r seed] [-o file]\n",
+			        argv[0]);
+			return 1;
+		}
+	}
+
+	if (path) {
+		out = fopen(path, "w");
+		if (!out) {
+			fprintf(stderr, "gencorpus: cannot write %s\n", path);
+			return 1;
+		}
+	}
+
+	for (unsigned long long written = 0; written < size; written += lineLen) {
+		lineLen = 0;
+		putLine(mix);
+		fwrite(line, 1, lineLen, out);
+	}
+
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
@@ -0,0 +1,448 @@
+/******************************************************************************
+* File:        handlers.c
+* Date:        05-04-26
+*
+* Description: Lexer project
+*
+* Notes: Per-handler microbenchmarks. Each handler is driven on its own over
+*        an input made only of the tokens it handles, separated by a single
+*        byte that the driver steps over itself, so nextToken()'s dispatch
+*        and the other handlers stay out of the numbers. lookUp() runs over
+*        a word list without a lexer at all.
+*
+*        On Linux the hardware counters (cycles, instructions, branch
+*        misses, L1D read misses) are read through perf_event_open. Any
+*        counter the kernel or the machine refuses (VMs, containers,
+*        perf_event_paranoid) is reported as n/a and the timings are still
+*        printed.
+*
+*        usage: handlers [-r runs] [-s size] [-o results]
+*          -r  timed runs per handler, the best is reported (default 5)
+*          -s  input bytes per handler (default 1M)
+*          -o  append JSON results to this file (default bench_output.txt)
+******************************************************************************/
+#define _GNU_SOURCE
+
+#include "lexer.h"
+#include "hash.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* ============================================================
+   ======================== COUNTERS ==========================
+   ============================================================ */
+
+typedef enum {
+    CTR_CYCLES,
+    CTR_INSTRUCTIONS,
+    CTR_BRANCHES,
+    CTR_BRANCH_MISSES,
+    CTR_L1D_MISSES,
+    CTR_COUNT
+} Counter;
+
+static const char *counterNames[CTR_COUNT] = {
+    "cycles", "instructions", "branches", "branch_misses", "l1d_misses"
+};
+
+typedef struct {
+    int fd[CTR_COUNT];          /* -1 when the counter is not available */
+    uint64_t value[CTR_COUNT];
+} Counters;
+
+#ifdef __linux__
+
+static int openCounter(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void countersOpen(Counters *c)
+{
+	c->fd[CTR_CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	c->fd[CTR_INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	c->fd[CTR_BRANCHES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+	c->fd[CTR_BRANCH_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	c->fd[CTR_L1D_MISSES] = openCounter(PERF_TYPE_HW_CACHE,
+	                                    PERF_COUNT_HW_CACHE_L1D |
+	                                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	                                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+static void countersStart(Counters *c)
+{
+	for (int i = 0; i < CTR_COUNT; i++) {
+		if (c->fd[i] >= 0) {
+			ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+static void countersStop(Counters *c)
+{
+	for (int i = 0; i < CTR_COUNT; i++) {
+		if (c->fd[i] >= 0)
+			ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+	}
+	for (int i = 0; i < CTR_COUNT; i++) {
+		uint64_t v = 0;
+
+		if (c->fd[i] >= 0 && read(c->fd[i], &v, sizeof(v)) == (ssize_t)sizeof(v))
+			c->value[i] += v;
+	}
+}
+
+static void countersClose(Counters *c)
+{
+	for (int i = 0; i < CTR_COUNT; i++) {
+		if (c->fd[i] >= 0)
+			close(c->fd[i]);
+	}
+}
+
+#else
+
+/* no perf_event_open, every counter reads as unavailable */
+static void countersOpen(Counters *c)
+{
+	for (int i = 0; i < CTR_COUNT; i++)
+		c->fd[i] = -1;
+}
+
+static void countersStart(Counters *c) { (void)c; }
+static void countersStop(Counters *c) { (void)c; }
+static void countersClose(Counters *c) { (void)c; }
+
+#endif
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* ============================================================
+   ========================= INPUTS ===========================
+   ============================================================ */
+
+static uint64_t rngState = 88172645463325252ULL;
+
+static unsigned below(unsigned n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 7;
+	rngState ^= rngState << 17;
+	return (unsigned)(rngState % n);
+}
+
+typedef void (*TokenMaker)(char *out, size_t *len);
+
+static void makeNumber(char *out, size_t *len)
+{
+	switch (below(4)) {
+	case 0:  *len = (size_t)sprintf(out, "0x%X", below(1u << 30)); break;
+	case 1:  *len = (size_t)sprintf(out, "%u.%u", 1 + below(999), below(100000)); break;
+	case 2:  *len = (size_t)sprintf(out, "0b%u%u%u%u", below(2), below(2), below(2), below(2)); break;
+	default: *len = (size_t)sprintf(out, "%u", 1 + below(1u << 30)); break;
+	}
+}
+
+static void makeString(char *out, size_t *len)
+{
+	size_t n = 4 + below(40);
+
+	out[0] = '"';
+	for (size_t i = 1; i <= n; i++)
+		out[i] = (char)('a' + below(26));
+	/* an escape now and then so the slow path gets some work too */
+	if (below(8) == 0) {
+		size_t at = 1 + below((unsigned)n - 1);
+
+		out[at] = '\\';
+		out[at + 1] = 't';
+	}
+	out[n + 1] = '"';
+	*len = n + 2;
+}
+
+static void makeChar(char *out, size_t *len)
+{
+	*len = (size_t)sprintf(out, "'%c'", 'a' + below(26));
+}
+
+static void makeOperator(char *out, size_t *len)
+{
+	static const char *ops[] = { "+", "-", "*", "/", ":=", "<=", ">=", "~=", "=", "<<",
+	                             ">>", "->", "!", "@", "+=", "<", ">", ":", "%", "=>" };
+
+	strcpy(out, ops[below(sizeof(ops) / sizeof(ops[0]))]);
+	*len = strlen(out);
+}
+
+static const char *words[] = {
+    "LET", "IF", "THEN", "RESULTIS", "VALOF", "WHILE", "GLOBAL", "MANIFEST",
+    "x", "count", "buffer", "writef", "newline", "result2", "Letter", "IFFY",
+    "librarypointer", "a1", "tempvalue", "TESTING"
+};
+
+static void makeIdent(char *out, size_t *len)
+{
+	strcpy(out, words[below(sizeof(words) / sizeof(words[0]))]);
+	*len = strlen(out);
+}
+
+static void makeDelim(char *out, size_t *len)
+{
+	static const char ws[] = "  \t\n";
+	size_t n = 1 + below(8);
+
+	for (size_t i = 0; i < n; i++)
+		out[i] = ws[below(sizeof(ws) - 1)];
+	*len = n;
+}
+
+/*
+ * Fills about size bytes with tokens from make, each followed by sep.
+ */
+static char *buildInput(TokenMaker make, char sep, size_t size, size_t *tokens)
+{
+	char *buf = malloc(size + 128);
+	size_t used = 0;
+
+	*tokens = 0;
+	if (!buf)
+		return NULL;
+
+	while (used < size) {
+		size_t len;
+
+		make(buf + used, &len);
+		used += len;
+		buf[used++] = sep;
+		(*tokens)++;
+	}
+	buf[used] = '\0';
+	return buf;
+}
+
+/* ============================================================
+   ========================= DRIVERS ==========================
+   ============================================================ */
+
+typedef Token (*HandlerFn)(LexerInfo *lxer);
+
+typedef struct {
+    const char *name;
+    HandlerFn handler;      /* NULL for the lookUp bench */
+    TokenMaker make;
+    char sep;
+} HandlerBench;
+
+static const HandlerBench benches[] = {
+    { "numHandler",    numHandler,    makeNumber,   ' ' },
+    { "stringHandler", stringHandler, makeString,   ' ' },
+    { "charHandler",   charHandler,   makeChar,     ' ' },
+    { "opHandler",     opHandler,     makeOperator, ' ' },
+    { "identHandler",  identHandler,  makeIdent,    ' ' },
+    { "delimHandler",  delimHandler,  makeDelim,    'x' },
+    { "lookUp",        NULL,          makeIdent,    ' ' },
+};
+
+static volatile size_t sink;
+
+/*
+ * One pass of a handler over the whole input, stepping over the separator
+ * byte after every token by hand.
+ */
+static void runHandler(HandlerFn handler, LexerInfo *lxer, const char *input)
+{
+	size_t total = 0;
+
+	lexerReset(lxer, input);
+	while (lxer->input[lxer->pos] != '\0') {
+		Token tok = handler(lxer);
+
+		total += tok.length;
+		lxer->pos++;
+	}
+	sink += total;
+}
+
+/*
+ * One pass of lookUpPadded, what identHandler calls, over the pre-split
+ * words. The corpus buffer is padded so the wide loads stay inside it.
+ */
+static void runLookUp(const char **starts, const size_t *lengths, size_t count)
+{
+	size_t hits = 0;
+
+	for (size_t i = 0; i < count; i++)
+		hits += lookUpPadded(starts[i], lengths[i]) != KEYWRD_NONE;
+	sink += hits;
+}
+
+/* ============================================================
+   =========================== MAIN ===========================
+   ============================================================ */
+
+static void printRate(const Counters *c, Counter num, Counter den, double scale)
+{
+	if (c->fd[num] >= 0 && c->fd[den] >= 0 && c->value[den])
+		printf(" %9.3f", (double)c->value[num] / (double)c->value[den] * scale);
+	else
+		printf(" %9s", "n/a");
+}
+
+int main(int argc, char **argv)
+{
+	const char *outPath = "bench_output.txt";
+	size_t size = 1 << 20;
+	int runs = 5;
+	Counters probe;
+	FILE *out;
+	bool anyCounter = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			runs = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			size = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			outPath = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [-r runs] [-s size] [-o results]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (runs < 1)
+		runs = 1;
+
+	out = fopen(outPath, "a");
+	if (!out) {
+		fprintf(stderr, "handlers: cannot open %s\n", outPath);
+		return 1;
+	}
+
+	countersOpen(&probe);
+	for (int i = 0; i < CTR_COUNT; i++)
+		anyCounter = anyCounter || probe.fd[i] >= 0;
+	countersClose(&probe);
+	if (!anyCounter)
+		fprintf(stderr, "handlers: hardware counters unavailable, timings only\n");
+
+	printf("%-14s %9s %9s %9s %9s %9s %9s\n",
+	       "handler", "ns/token", "MB/s", "IPC", "br-miss%", "br-miss/t", "L1D-miss/t");
+
+	for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+		const HandlerBench *hb = &benches[b];
+		size_t tokens, bytes;
+		char *input = buildInput(hb->make, hb->sep, size, &tokens);
+		const char **starts = NULL;
+		size_t *lengths = NULL;
+		LexerInfo lxer;
+		Counters c;
+		double best = -1.0;
+
+		if (!input)
+			return 1;
+		bytes = strlen(input);
+		lexerInit(&lxer, input);
+
+		/* lookUp gets the words already split, like identHandler hands them over */
+		if (!hb->handler) {
+			size_t n = 0;
+			const char *p = input;
+
+			starts = malloc(tokens * sizeof(*starts));
+			lengths = malloc(tokens * sizeof(*lengths));
+			if (!starts || !lengths)
+				return 1;
+			while (*p) {
+				const char *sp = strchr(p, hb->sep);
+
+				starts[n] = p;
+				lengths[n++] = (size_t)(sp - p);
+				p = sp + 1;
+			}
+		}
+
+		countersOpen(&c);
+		memset(c.value, 0, sizeof(c.value));
+
+		/* one untimed pass to warm caches and predictors */
+		if (hb->handler)
+			runHandler(hb->handler, &lxer, input);
+		else
+			runLookUp(starts, lengths, tokens);
+
+		for (int r = 0; r < runs; r++) {
+			double start = now(), elapsed;
+
+			countersStart(&c);
+			if (hb->handler)
+				runHandler(hb->handler, &lxer, input);
+			else
+				runLookUp(starts, lengths, tokens);
+			countersStop(&c);
+
+			elapsed = now() - start;
+			if (best < 0 || elapsed < best)
+				best = elapsed;
+		}
+
+		printf("%-14s %9.2f %9.1f", hb->name, best * 1e9 / (double)tokens,
+		       (double)bytes / best / 1e6);
+		printRate(&c, CTR_INSTRUCTIONS, CTR_CYCLES, 1.0);
+		printRate(&c, CTR_BRANCH_MISSES, CTR_BRANCHES, 100.0);
+		if (c.fd[CTR_BRANCH_MISSES] >= 0)
+			printf(" %9.4f", (double)c.value[CTR_BRANCH_MISSES] / ((double)tokens * runs));
+		else
+			printf(" %9s", "n/a");
+		if (c.fd[CTR_L1D_MISSES] >= 0)
+			printf(" %9.4f\n", (double)c.value[CTR_L1D_MISSES] / ((double)tokens * runs));
+		else
+			printf(" %9s\n", "n/a");
+
+		fprintf(out, "{\"bench\":\"handler\",\"handler\":\"%s\",\"bytes\":%zu,\"tokens\":%zu,"
+		             "\"runs\":%d,\"seconds\":%.9f,\"ns_per_token\":%.3f",
+		        hb->name, bytes, tokens, runs, best, best * 1e9 / (double)tokens);
+		for (int i = 0; i < CTR_COUNT; i++) {
+			if (c.fd[i] >= 0)
+				fprintf(out, ",\"%s\":%llu", counterNames[i], (unsigned long long)c.value[i]);
+			else
+				fprintf(out, ",\"%s\":null", counterNames[i]);
+		}
+		fprintf(out, "}\n");
+
+		countersClose(&c);
+		lexerRelease(&lxer);
+		free(starts);
+		free(lengths);
+		free(input);
+	}
+
+	fclose(out);
+	return 0;
+}
@@ -0,0 +1,162 @@
+/******************************************************************************
+* File:        throughput.c
+* Date:        04-27-26
+*
+* Description: Lexer project
+*
+* Notes: End-to-end nextToken() throughput. Every input is lexed start to
+*        EOF several times through one reused lexer and the fastest run is
+*        kept, the first run also warms the page cache and branch
+*        predictors. Prints a readable line per input and appends one
+*        JSON object per input to the results file so runs can be diffed
+*        and tracked over time.
+*
+*        usage: throughput [-r runs] [-l label] [-e engine] [-o results] file...
+*          -r  timed runs per file, the best is reported (default 5)
+*          -l  free form label stored with every result, e.g. the -O level
+*          -e  switch (lexToken, default) or table (the generated lexTable)
+*          -o  append results to this file (default bench_output.txt)
+******************************************************************************/
+#define _POSIX_C_SOURCE 199309L
+
+#include "lexer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    size_t bytes;
+    size_t tokens;
+    size_t errors;
+    double seconds;     /* fastest run */
+} BenchResult;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void countError(int line, int col, const char *msg, void *userData, const char *errChar)
+{
+	(void)line;
+	(void)col;
+	(void)msg;
+	(void)errChar;
+	(*(size_t *)userData)++;
+}
+
+/*
+ * Lexes input to EOF runs times and keeps the fastest time. The token
+ * lengths are summed into a volatile so the loop can't be optimized away.
+ * lxer->errorUserData has to point at the error counter.
+ */
+static BenchResult benchInput(LexerInfo *lxer, const char *input, int runs)
+{
+	BenchResult res = {0};
+	static volatile size_t sink;
+	size_t *errors = lxer->errorUserData;
+
+	res.bytes = strlen(input);
+	res.seconds = -1.0;
+
+	for (int r = 0; r < runs; r++) {
+		size_t tokens = 0, total = 0;
+		double start, elapsed;
+		Token tok;
+
+		lexerReset(lxer, input);
+		*errors = 0;
+
+		start = now();
+		do {
+			tok = nextToken(lxer);
+			total += tok.length;
+			tokens++;
+		} while (tok.type != TOKEN_EOF);
+		elapsed = now() - start;
+
+		sink += total;
+		res.tokens = tokens;
+		res.errors = *errors;
+		if (res.seconds < 0 || elapsed < res.seconds)
+			res.seconds = elapsed;
+	}
+
+	return res;
+}
+
+int main(int argc, char **argv)
+{
+	const char *label = "";
+	const char *outPath = "bench_output.txt";
+	const char *engine = "switch";
+	int runs = 5;
+	FILE *out;
+	int status = 0;
+	int first;
+
+	for (first = 1; first < argc; first++) {
+		if (strcmp(argv[first], "-r") == 0 && first + 1 < argc)
+			runs = atoi(argv[++first]);
+		else if (strcmp(argv[first], "-l") == 0 && first + 1 < argc)
+			label = argv[++first];
+		else if (strcmp(argv[first], "-e") == 0 && first + 1 < argc)
+			engine = argv[++first];
+		else if (strcmp(argv[first], "-o") == 0 && first + 1 < argc)
+			outPath = argv[++first];
+		else
+			break;
+	}
+
+	if (first == argc || runs < 1 || (strcmp(engine, "switch") != 0 && strcmp(engine, "table") != 0)) {
+		fprintf(stderr, "usage: %s [-r runs] [-l label] [-e engine] [-o results] file...\n", argv[0]);
+		return 1;
+	}
+
+	out = fopen(outPath, "a");
+	if (!out) {
+		fprintf(stderr, "throughput: cannot open %s\n", outPath);
+		return 1;
+	}
+
+	for (int i = first; i < argc; i++) {
+		LexerInfo *file = lexerCreateFromFile(argv[i]);
+		LexerInfo lxer;
+		size_t errors = 0;
+		BenchResult res;
+		double mbs, tps, nspt;
+
+		if (!file) {
+			fprintf(stderr, "throughput: cannot read %s\n", argv[i]);
+			status = 1;
+			continue;
+		}
+
+		/* file only holds the contents, the runs use a plain stack lexer */
+		lexerInit(&lxer, file->input);
+		lxer.errorFn = countError;
+		lxer.errorUserData = &errors;
+		lxer.tableDriven = strcmp(engine, "table") == 0;
+		res = benchInput(&lxer, file->input, runs);
+		mbs = (double)res.bytes / res.seconds / 1e6;
+		tps = (double)res.tokens / res.seconds;
+		nspt = res.seconds * 1e9 / (double)res.tokens;
+
+		printf("%-8s %-6s %-40s %10.1f MB/s %12.0f tokens/s %8.2f ns/token\n",
+		       label, engine, argv[i], mbs, tps, nspt);
+		fprintf(out, "{\"bench\":\"nextToken\",\"label\":\"%s\",\"engine\":\"%s\",\"input\":\"%s\",\"bytes\":%zu,"
+		             "\"tokens\":%zu,\"errors\":%zu,\"runs\":%d,\"seconds\":%.9f,"
+		             "\"mb_per_s\":%.3f,\"tokens_per_s\":%.0f,\"ns_per_token\":%.3f}\n",
+		        label, engine, argv[i], res.bytes, res.tokens, res.errors, runs, res.seconds,
+		        mbs, tps, nspt);
+
+		lexerRelease(&lxer);
+		lexerDestroy(file);
+	}
+
+	fclose(out);
+	return status;
+}
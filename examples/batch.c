@@ -0,0 +1,209 @@
+/******************************************************************************
+* File:        batch.c
+* Date:        03-23-26
+*
+* Description: Lexer project
+*
+* Notes: lexbatch, lexes a whole list of files or directories on every core
+*        and prints one summary line per file in the order they were given.
+*
+*        usage: lexbatch [-j threads] [-t] [-s] [-e maxerrors] [-c cachedir] [-l listfile] path...
+*          -j  number of worker threads, default one per core
+*          -t  also print every token of every file
+*          -s  intern identifiers into one table shared by all files
+*          -e  after this many errors in a file skip the rest of each bad line
+*          -c  reuse the tokens of unchanged files from this cache directory
+*          -l  read more paths from listfile, one per line ("-" is stdin)
+*        directories are searched recursively for .b .bcpl and .h files
+******************************************************************************/
+#define _DEFAULT_SOURCE
+
+#include "batch.h"
+#include "intern.h"
+#include "cache.h"
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+static bool addPath(PathList *list, const char *path)
+{
+	if (list->count == list->capacity) {
+		size_t cap = list->capacity ? list->capacity * 2 : 64;
+		char **grown = realloc(list->paths, cap * sizeof(char *));
+
+		if (!grown)
+			return false;
+		list->paths = grown;
+		list->capacity = cap;
+	}
+
+	list->paths[list->count] = strdup(path);
+	if (!list->paths[list->count])
+		return false;
+	list->count++;
+	return true;
+}
+
+static bool isSourceName(const char *name)
+{
+	const char *dot = strrchr(name, '.');
+
+	return dot && (strcmp(dot, ".b") == 0 || strcmp(dot, ".bcpl") == 0 ||
+	               strcmp(dot, ".h") == 0);
+}
+
+static int byName(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Adds a file, or every source file under a directory sorted by name so the
+ * output order does not depend on the file system.
+ */
+static void addTree(PathList *list, const char *path)
+{
+	struct stat st;
+	PathList found = {0};
+	struct dirent *ent;
+	DIR *dir;
+
+	if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		addPath(list, path);
+		return;
+	}
+
+	dir = opendir(path);
+	if (!dir)
+		return;
+
+	while ((ent = readdir(dir)) != NULL) {
+		char child[4096];
+
+		if (ent->d_name[0] == '.')
+			continue;
+		snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+		if (stat(child, &st) == 0 && (S_ISDIR(st.st_mode) || isSourceName(ent->d_name)))
+			addPath(&found, child);
+	}
+	closedir(dir);
+
+	if (found.count)
+		qsort(found.paths, found.count, sizeof(char *), byName);
+	for (size_t i = 0; i < found.count; i++) {
+		addTree(list, found.paths[i]);
+		free(found.paths[i]);
+	}
+	free(found.paths);
+}
+
+static void addListFile(PathList *list, const char *listFile)
+{
+	FILE *in = strcmp(listFile, "-") == 0 ? stdin : fopen(listFile, "r");
+	char line[4096];
+
+	if (!in) {
+		fprintf(stderr, "lexbatch: cannot open %s\n", listFile);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0])
+			addTree(list, line);
+	}
+
+	if (in != stdin)
+		fclose(in);
+}
+
+int main(int argc, char **argv)
+{
+	PathList list = {0};
+	unsigned threads = 0;
+	bool printTokens = false;
+	InternTable *symbols = NULL;
+	size_t maxErrors = 0;
+	TokenCache *cache = NULL;
+	BatchFile *files;
+	int status = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			threads = (unsigned)atoi(argv[++i]);
+		else if (strcmp(argv[i], "-t") == 0)
+			printTokens = true;
+		else if (strcmp(argv[i], "-s") == 0 && !symbols)
+			symbols = internCreate(0);
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+			maxErrors = (size_t)strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && !cache) {
+			cache = tokenCacheOpen(argv[++i], 0);
+			if (!cache)
+				fprintf(stderr, "lexbatch: cannot use cache %s\n", argv[i]);
+		}
+		else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+			addListFile(&list, argv[++i]);
+		else
+			addTree(&list, argv[i]);
+	}
+
+	if (list.count == 0) {
+		fprintf(stderr, "usage: %s [-j threads] [-t] [-s] [-e maxerrors] [-c cachedir] [-l listfile] path...\n", argv[0]);
+		return 1;
+	}
+
+	files = calloc(list.count, sizeof(BatchFile));
+	if (!files)
+		return 1;
+	for (size_t i = 0; i < list.count; i++)
+		files[i].path = list.paths[i];
+
+	if (!lexBatchRun(files, list.count, threads, printTokens, symbols, maxErrors, cache)) {
+		fprintf(stderr, "lexbatch: could not start workers\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < list.count; i++) {
+		BatchFile *f = &files[i];
+
+		if (!f->ok) {
+			printf("%s\tFAILED\n", f->path);
+			status = 1;
+			continue;
+		}
+
+		printf("%s\ttokens %zu\tlines %zu\terrors %zu%s\n",
+		       f->path, f->tokens.count, f->lines, f->errors, f->cached ? "\tcached" : "");
+
+		if (printTokens) {
+			for (size_t t = 0; t < f->tokens.count; t++) {
+				Token tok = {0};
+
+				tok.type = (TokenType)f->tokens.types[t];
+				tok.start = f->lexer->input + f->tokens.offsets[t];
+				tok.length = f->tokens.lengths[t];
+				printTokenType(tok);
+			}
+		}
+	}
+
+	if (symbols)
+		printf("symbols %zu\n", internCount(symbols));
+
+	lexBatchFree(files, list.count);
+	internDestroy(symbols);
+	tokenCacheClose(cache);
+	for (size_t i = 0; i < list.count; i++)
+		free(list.paths[i]);
+	free(list.paths);
+	free(files);
+	return status;
+}
@@ -26,23 +26,29 @@ int main()
 
 	const char *filename = "test.bcpl";
 	LexerInfo *lxer = lexerCreateFromFile(filename);
+	if (!lxer) {
+		printf("No file found!\n");
+		return 1;
+	}
     lxer->errorFn = errorHandler;
     //make sure to set the void pointer for whatever main will pass to the lexer error handler 
     lxer->errorUserData = NULL;
-	Token t;
-
-	do {
-		if (!lxer) {
-			printf("No file found!\n");
-			break;
-		}
-		t = nextToken(lxer);
-		if (t.type != TOKEN_DELIM_S)
-			printTokenType(t);
-	}while (t.type != TOKEN_EOF);
+    //spaces are skipped inside nextToken, every other token is printed
+    lxer->triviaMask = LEXER_TRIVIA(TOKEN_DELIM_S);
+	//tokens are pushed to the sinks a batch at a time, printing is just one of them
+	lexerAddSink(lxer, printTokenSink, NULL);
+	lexerRun(lxer);
 
     printf("Lines: %ld\n", lxer->lines);
     printf("Col @ end: %ld\n", lxer->cols);
+#ifdef LEXER_STATS
+	{
+		LexerStats stats;
+
+		if (lexerGetStats(lxer, &stats))
+			printLexerStats(&stats);
+	}
+#endif
 	lexerDestroy(lxer);
 	return 0;
 }
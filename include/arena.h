@@ -0,0 +1,47 @@
+/******************************************************************************
+* File:        arena.h
+* Date:        04-20-26
+*
+* Description: Lexer project
+*
+* Notes: Header file for the bump allocator used for token buffers and the
+*        intern table
+******************************************************************************/
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifndef ARENA_BLOCK_SIZE
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#endif
+
+/* every allocation is aligned to this */
+#define ARENA_ALIGN 16
+
+typedef struct ArenaBlock ArenaBlock;
+
+/*
+ * Memory is handed out from the front block and never freed one piece at a
+ * time. arenaReset() gives everything back at once but keeps the blocks
+ * for the next round, arenaFree() returns them to the system. An arena is
+ * not thread safe, give every thread its own.
+ */
+typedef struct Arena {
+    ArenaBlock *blocks;     /* blocks in use, newest first            */
+    ArenaBlock *oldest;     /* last block of that list                */
+    ArenaBlock *spare;      /* blocks kept by arenaReset()            */
+    size_t blockSize;       /* minimum size of a new block            */
+} Arena;
+
+/* =======================
+          Prototypes
+   ======================= */
+
+void arenaInit(Arena *arena, size_t blockSize);
+void *arenaAlloc(Arena *arena, size_t size);
+void *arenaGrow(Arena *arena, void *ptr, size_t oldSize, size_t newSize);
+void arenaReset(Arena *arena);
+void arenaFree(Arena *arena);
+
+#endif /* ARENA_H */
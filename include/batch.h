@@ -0,0 +1,43 @@
+/******************************************************************************
+* File:        batch.h
+* Date:        03-23-26
+*
+* Description: Lexer project
+*
+* Notes: Header file for lexing many files at once on a thread pool
+******************************************************************************/
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "lexer.h"
+
+struct TokenCache;
+struct BatchArenas;
+
+/*
+ * One input file of a batch. Only path is filled in by the caller, the rest
+ * is the result. Results stay in the order the files were given no matter
+ * which worker lexed them or when.
+ */
+typedef struct {
+    const char *path;       /* caller owned                                  */
+    size_t size;            /* file size in bytes, used for scheduling       */
+    TokenBuffer tokens;     /* offsets index into the file contents          */
+    size_t lines;           /* lexer lines/cols after the EOF token          */
+    size_t cols;
+    size_t errors;          /* errors the lexer raised, also past maxErrors  */
+    LexerInfo *lexer;       /* kept (with its input) only when keepInput set */
+    struct BatchArenas *arenas; /* worker arenas tokens live in, batch wide  */
+    bool cached;            /* tokens came from the token cache              */
+    bool ok;                /* false if the file could not be read           */
+} BatchFile;
+
+/* =======================
+          Prototypes
+   ======================= */
+
+bool lexBatchRun(BatchFile *files, size_t count, unsigned threads, bool keepInput,
+                 struct InternTable *symbols, size_t maxErrors, struct TokenCache *cache);
+void lexBatchFree(BatchFile *files, size_t count);
+
+#endif /* BATCH_H */
@@ -0,0 +1,44 @@
+/******************************************************************************
+* File:        cache.h
+* Date:        05-11-26
+*
+* Description: Lexer project
+*
+* Notes: Header file for the on disk token cache, token streams of inputs
+*        that were lexed before are mapped back in instead of lexed again
+******************************************************************************/
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "lexer.h"
+
+/* size the cache directory is kept under when tokenCacheOpen gets 0 */
+#define TOKEN_CACHE_DEFAULT_LIMIT ((size_t)256 * 1024 * 1024)
+
+typedef struct TokenCache TokenCache;
+
+/*
+ * What an input is cached under: a 128 bit hash of the text seeded with
+ * the lexer settings that change the tokens (LEXER_VERSION, triviaMask)
+ * or the lines/cols left behind (lazyPositions).
+ */
+typedef struct {
+    uint64_t hash[2];
+    size_t length;      /* bytes of input hashed */
+    uint64_t triviaMask;
+    bool lazyPositions;
+} TokenCacheKey;
+
+/* =======================
+          Prototypes
+   ======================= */
+
+TokenCache *tokenCacheOpen(const char *dir, size_t maxBytes);
+void tokenCacheClose(TokenCache *cache);
+
+void tokenCacheKeyFor(const LexerInfo *lxer, TokenCacheKey *key);
+bool tokenCacheLoad(TokenCache *cache, const TokenCacheKey *key, LexerInfo *lxer, TokenBuffer *out);
+bool tokenCacheStore(TokenCache *cache, const TokenCacheKey *key, const LexerInfo *lxer,
+                     const TokenBuffer *buf);
+
+#endif /* CACHE_H */
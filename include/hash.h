@@ -28,6 +28,68 @@ typedef uint8_t bool;
 #define MAX_IDENT_LEN 10
 
 
-bool lookUp(const char *keyword, size_t len);
+/* =======================
+    Keyword Ids
+   ======================= */
+
+typedef enum {
+    KEYWRD_NONE,    /* not a keyword */
+    KEYWRD_AND,
+    KEYWRD_BE,
+    KEYWRD_BREAK,
+    KEYWRD_BY,
+    KEYWRD_CASE,
+    KEYWRD_DEFAULT,
+    KEYWRD_DO,
+    KEYWRD_ELSE,
+    KEYWRD_EQ,
+    KEYWRD_FALSE,
+    KEYWRD_FOR,
+    KEYWRD_GE,
+    KEYWRD_GET,
+    KEYWRD_GLOBAL,
+    KEYWRD_GOTO,
+    KEYWRD_GR,
+    KEYWRD_IF,
+    KEYWRD_INTO,
+    KEYWRD_LET,
+    KEYWRD_LEVEL,
+    KEYWRD_LOOP,
+    KEYWRD_LS,
+    KEYWRD_MANIFEST,
+    KEYWRD_NE,
+    KEYWRD_NOT,
+    KEYWRD_OR,
+    KEYWRD_RESULTIS,
+    KEYWRD_RESULTS,
+    KEYWRD_RETURN,
+    KEYWRD_SECTION,
+    KEYWRD_STATIC,
+    KEYWRD_SWITCH,
+    KEYWRD_SWITCHON,
+    KEYWRD_TABLE,
+    KEYWRD_TEST,
+    KEYWRD_THEN,
+    KEYWRD_TO,
+    KEYWRD_TRUE,
+    KEYWRD_UNLESS,
+    KEYWRD_UNTIL,
+    KEYWRD_VALOF,
+    KEYWRD_VEC,
+    KEYWRD_WHILE,
+    KEYWRD_WRITEF,
+    KEYWRD_COUNT
+} Keyword;
+
+
+Keyword lookUp(const char *keyword, size_t len);
+
+/*
+ * lookUp() for input the lexer owns. Reads 8 bytes from keyword whatever
+ * len is unless that crosses a page, so keyword has to be followed by
+ * readable bytes (LEXER_PADDING in lexer.h). Only lookUp() is safe on an
+ * arbitrary caller buffer.
+ */
+Keyword lookUpPadded(const char *keyword, size_t len);
      
 #endif /* HASH_H */
\ No newline at end of file
@@ -0,0 +1,50 @@
+/******************************************************************************
+* File:        intern.h
+* Date:        04-13-26
+*
+* Description: Lexer project
+*
+* Notes: Header file for the identifier interning table shared by lexers
+******************************************************************************/
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "lexer.h"
+
+/* id of "no symbol", real ids start at 1 */
+#define SYMBOL_NONE 0
+
+/*
+ * Upper bound on distinct names a table can hold. Ids are handed out
+ * densely so they can index a plain array on the caller's side.
+ */
+#define INTERN_CHUNK_BITS  12
+#define INTERN_MAX_CHUNKS  4096
+#define INTERN_MAX_SYMBOLS ((size_t)INTERN_MAX_CHUNKS << INTERN_CHUNK_BITS)
+
+#define INTERN_HASH_SEED 2166136261u
+
+typedef struct InternTable InternTable;
+
+/*
+ * One step of the 32 bit FNV-1a hash the table is keyed by. identHandler
+ * runs it while it scans so the name is never walked a second time.
+ */
+static inline uint32_t internHashStep(uint32_t hash, unsigned char c)
+{
+    return (hash ^ c) * 16777619u;
+}
+
+/* =======================
+          Prototypes
+   ======================= */
+
+InternTable *internCreate(size_t expectedSymbols);
+void internDestroy(InternTable *table);
+
+uint32_t intern(InternTable *table, const char *name, size_t length);
+uint32_t internHashed(InternTable *table, const char *name, size_t length, uint32_t hash);
+const char *internName(const InternTable *table, uint32_t id, size_t *length);
+size_t internCount(const InternTable *table);
+
+#endif /* INTERN_H */
@@ -24,71 +24,94 @@ typedef uint8_t bool;
 #define true  1
 #define false 0
 
+/*
+ * Bump whenever the tokens produced for some input change. Cached token
+ * streams (cache.h) written by another version are ignored.
+ */
+#define LEXER_VERSION 2
+
+/*
+ * Bytes past the end of the input the lexer may read but never treats as
+ * input, the scan kernels load whole blocks. Buffers the lexer allocates
+ * leave this much room after the input, spans handed to
+ * lexerCreateFromSpan() need it readable.
+ */
+#define LEXER_PADDING 64
+
+/*
+ * Every token type with the operator or punctuation it is spelled as, NULL
+ * for the rest. tools/gentables.c builds the tables of the generated engine
+ * (lextables.h) from the spellings, a type without one is never produced
+ * by it.
+ */
 #define TOKEN_LIST \
     /* ================= IDENTIFIERS / LITERALS ================= */ \
-    X(TOKEN_IDEN_GENERIC) \
-    X(TOKEN_KEYWORD) \
-    X(TOKEN_INT) \
-    X(TOKEN_FLOAT) \
-    X(TOKEN_STRING) \
-    X(TOKEN_CHAR) \
-    X(TOKEN_HEX) \
-    X(TOKEN_BIN) \
-    X(TOKEN_OCT) \
+    X(TOKEN_IDEN_GENERIC,  NULL) \
+    X(TOKEN_KEYWORD,       NULL) \
+    X(TOKEN_INT,           NULL) \
+    X(TOKEN_FLOAT,         NULL) \
+    X(TOKEN_STRING,        NULL) \
+    X(TOKEN_CHAR,          NULL) \
+    X(TOKEN_HEX,           NULL) \
+    X(TOKEN_BIN,           NULL) \
+    X(TOKEN_OCT,           NULL) \
     /* ================= SINGLE-CHAR OPERATORS ================= */ \
-    X(TOKEN_PLUS) \
-    X(TOKEN_MINUS) \
-    X(TOKEN_MUL) \
-    X(TOKEN_DIV) \
-    X(TOKEN_MOD) \
-    X(TOKEN_ASSIGN) \
-    X(TOKEN_LT) \
-    X(TOKEN_GT) \
-    X(TOKEN_SEMICOL) \
-    X(TOKEN_LBRACE) \
-    X(TOKEN_RBRACE) \
-    X(TOKEN_LBRAK) \
-    X(TOKEN_RBRAk) \
-    X(TOKEN_LPAREN) \
-    X(TOKEN_RPAREN) \
-    X(TOKEN_OBJ_INDREC) \
-    X(TOKEN_INDIRECTION) \
-    X(TOKEN_STRUC_REF) \
-    X(TOKEN_COLON) \
-    X(TOKEN_SEPERATOR) \
+    X(TOKEN_PLUS,          "+") \
+    X(TOKEN_MINUS,         "-") \
+    X(TOKEN_MUL,           "*") \
+    X(TOKEN_DIV,           "/") \
+    X(TOKEN_MOD,           "%") \
+    X(TOKEN_ASSIGN,        ":=") \
+    X(TOKEN_LT,            "<") \
+    X(TOKEN_GT,            ">") \
+    X(TOKEN_SEMICOL,       ";") \
+    X(TOKEN_LBRACE,        "{") \
+    X(TOKEN_RBRACE,        "}") \
+    X(TOKEN_LBRAK,         "[") \
+    X(TOKEN_RBRAk,         "]") \
+    X(TOKEN_LPAREN,        "(") \
+    X(TOKEN_RPAREN,        ")") \
+    X(TOKEN_OBJ_INDREC,    "->") \
+    X(TOKEN_INDIRECTION,   "!") \
+    X(TOKEN_STRUC_REF,     "=>") \
+    X(TOKEN_COLON,         ":") \
+    X(TOKEN_SEPERATOR,     ",") \
     /* ================= MULTI-CHAR OPERATORS ================= */ \
-    X(TOKEN_LITERAL) \
-    X(TOKEN_NEGATION) \
-    X(TOKEN_EQ_EQ) \
-    X(TOKEN_LOGICAL_NOT) \
-    X(TOKEN_NOTEQ) \
-    X(TOKEN_LTE) \
-    X(TOKEN_GTE) \
-    X(TOKEN_PLUS_EQ) \
-    X(TOKEN_MINUS_EQ) \
-    X(TOKEN_MUL_EQ) \
-    X(TOKEN_DIV_EQ) \
-    X(TOKEN_INCR) \
-    X(TOKEN_DECR) \
-    X(TOKEN_BITWISEL) \
-    X(TOKEN_BITWISER) \
-    X(TOKEN_ADDRESS_OF) \
+    X(TOKEN_LITERAL,       NULL) \
+    X(TOKEN_NEGATION,      NULL) \
+    X(TOKEN_EQ_EQ,         "=") \
+    X(TOKEN_LOGICAL_NOT,   "~") \
+    X(TOKEN_NOTEQ,         "~=") \
+    X(TOKEN_LTE,           "<=") \
+    X(TOKEN_GTE,           ">=") \
+    X(TOKEN_PLUS_EQ,       "+=") \
+    X(TOKEN_MINUS_EQ,      "-=") \
+    X(TOKEN_MUL_EQ,        "*=") \
+    X(TOKEN_DIV_EQ,        "/=") \
+    X(TOKEN_INCR,          NULL) \
+    X(TOKEN_DECR,          NULL) \
+    X(TOKEN_BITWISEL,      "<<") \
+    X(TOKEN_BITWISER,      ">>") \
+    X(TOKEN_ADDRESS_OF,    "@") \
     /* ================= DELIMITERS / WHITESPACE ================= */ \
-    X(TOKEN_DELIM_F) \
-    X(TOKEN_DELIM_N) \
-    X(TOKEN_DELIM_R) \
-    X(TOKEN_DELIM_T) \
-    X(TOKEN_DELIM_V) \
-    X(TOKEN_DELIM_S) \
-    X(TOKEN_DELIM_U) \
+    X(TOKEN_DELIM_F,       NULL) \
+    X(TOKEN_DELIM_N,       NULL) \
+    X(TOKEN_DELIM_R,       NULL) \
+    X(TOKEN_DELIM_T,       NULL) \
+    X(TOKEN_DELIM_V,       NULL) \
+    X(TOKEN_DELIM_S,       NULL) \
+    X(TOKEN_DELIM_U,       NULL) \
     /* ================= SPECIAL ================= */ \
-    X(TOKEN_OPER) \
-    X(TOKEN_EOF) \
-    X(TOKEN_ERR) \
-    X(TOKEN_UNKNOWN) \
-    X(TOKEN_COMMENT) \
+    X(TOKEN_OPER,          NULL) \
+    X(TOKEN_EOF,           NULL) \
+    X(TOKEN_ERR,           NULL) \
+    X(TOKEN_UNKNOWN,       NULL) \
+    X(TOKEN_COMMENT,       NULL) \
+
 
 
+struct InternTable;
+struct Arena;
 
 typedef void (*LexerErrorCallback)(int line, int column, const char *message, void *userData, const char *errChar);
 
@@ -97,11 +120,99 @@ typedef void (*LexerErrorCallback)(int line, int column, const char *message, vo
    ======================= */
 
 typedef enum {
-    #define X(name) name,
+    #define X(name, spelling) name,
         TOKEN_LIST
     #undef X
         TOKEN_COUNT
 } TokenType;
+
+/*
+ * Bits for LexerInfo.triviaMask, one per TokenType. nextToken() skips
+ * tokens whose bit is set.
+ */
+#define LEXER_TRIVIA(type) ((uint64_t)1 << (type))
+#define LEXER_TRIVIA_WHITESPACE (LEXER_TRIVIA(TOKEN_DELIM_F) | LEXER_TRIVIA(TOKEN_DELIM_N) | \
+                                 LEXER_TRIVIA(TOKEN_DELIM_R) | LEXER_TRIVIA(TOKEN_DELIM_T) | \
+                                 LEXER_TRIVIA(TOKEN_DELIM_V) | LEXER_TRIVIA(TOKEN_DELIM_S) | \
+                                 LEXER_TRIVIA(TOKEN_DELIM_U))
+#define LEXER_TRIVIA_DEFAULT (LEXER_TRIVIA_WHITESPACE | LEXER_TRIVIA(TOKEN_COMMENT))
+
+/* every error the lexer can raise with the message handed to errorFn */
+#define ERROR_LIST \
+    X(LEX_ERR_UNTERMINATED_COMMENT, "Unterminated comment") \
+    X(LEX_ERR_OUT_OF_PLACE,         "Out of place character") \
+    X(LEX_ERR_EMPTY_CHAR,           "Empty Character Literal") \
+    X(LEX_ERR_UNTERMINATED_CHAR,    "Unterminated Character Literal") \
+    X(LEX_ERR_CHAR_NEWLINE,         "Escaped newline not valid character literal") \
+    X(LEX_ERR_CHAR_ESCAPE,          "Malformed Escape Character") \
+    X(LEX_ERR_CHAR_TOO_LONG,        "Character Literal too long") \
+    X(LEX_ERR_EMPTY_STRING,         "Empty String Literal") \
+    X(LEX_ERR_UNTERMINATED_STRING,  "Unterminated String") \
+    X(LEX_ERR_STRING_ESCAPE,        "Malformed escape character") \
+    X(LEX_ERR_MALFORMED_INT,        "Malformed Integer Literal") \
+    X(LEX_ERR_MALFORMED_UNNAMED,    "Malformed unnamed Literal") \
+    X(LEX_ERR_MALFORMED_LITERAL,    "Malformed Literal General") \
+    X(LEX_ERR_MALFORMED_FLOAT,      "Malformed Float Literal") \
+    X(LEX_ERR_MALFORMED_HEX,        "Malformed Hex Literal") \
+    X(LEX_ERR_MALFORMED_BIN,        "Malformed Binary Literal") \
+    X(LEX_ERR_MALFORMED_OCT,        "Malformed Octal Literal") \
+    X(LEX_ERR_EMBEDDED_NUL,         "NUL character inside the input")
+
+typedef enum {
+    #define X(name, message) name,
+        ERROR_LIST
+    #undef X
+        LEX_ERR_COUNT
+} LexerErrorCode;
+
+/*
+ * An error recorded while bufferDiagnostics is set. The position and
+ * message are worked out from these when the record is flushed.
+ */
+typedef struct {
+    size_t   offset;    /* lexer->pos when the error was raised */
+    uint8_t  code;      /* LexerErrorCode                       */
+} LexerDiagnostic;
+
+/*
+ * Which branch of nextToken() produced a token, for the instrumentation
+ * counters below.
+ */
+typedef enum {
+    LEXER_BRANCH_LINE_COMMENT,
+    LEXER_BRANCH_BLOCK_COMMENT,
+    LEXER_BRANCH_DELIM,
+    LEXER_BRANCH_NUMBER,
+    LEXER_BRANCH_IDENT,
+    LEXER_BRANCH_PUNCT,
+    LEXER_BRANCH_OPERATOR,
+    LEXER_BRANCH_STRING,
+    LEXER_BRANCH_CHAR,
+    LEXER_BRANCH_EOF,
+    LEXER_BRANCH_UNKNOWN,
+    LEXER_BRANCH_COUNT
+} LexerBranch;
+
+#define LEXER_STATS_MAX_MESSAGES 32
+
+/*
+ * Hot path counters. Only filled in when the library is built with
+ * -DLEXER_STATS (make STATS=1), cycles also need -DLEXER_STATS_CYCLES
+ * (make STATS_CYCLES=1) and an x86 target. Without the flag none of the
+ * counting code is compiled in.
+ */
+typedef struct {
+    uint64_t tokens[TOKEN_COUNT];               /* tokens returned per TokenType   */
+    uint64_t branchTokens[LEXER_BRANCH_COUNT];  /* tokens per nextToken() branch   */
+    uint64_t branchBytes[LEXER_BRANCH_COUNT];   /* input bytes consumed per branch */
+    uint64_t branchCycles[LEXER_BRANCH_COUNT];  /* rdtsc ticks spent per branch    */
+    struct {
+        const char *message;
+        uint64_t count;
+    } errors[LEXER_STATS_MAX_MESSAGES];         /* error reports per message       */
+    size_t errorKinds;                          /* used entries of errors          */
+    uint64_t errorsOther;                       /* reports once errors is full     */
+} LexerStats;
  
 
 
@@ -110,22 +221,121 @@ typedef enum {
         Lexer Structs
     ======================= */
 
+#define TOKEN_FLAG_OVERFLOW 0x01  /* decoded literal did not fit, value is saturated */
+
 typedef struct {
     TokenType type;
+    uint8_t keyword;   // Keyword id from hash.h when type is TOKEN_KEYWORD
+    uint8_t flags;     // TOKEN_FLAG_* bits
     const char *start; // points into lexer->input
     size_t length;
+    union {
+        uint64_t intVal;   // TOKEN_INT/HEX/BIN/OCT when lexer->decodeLiterals
+        double floatVal;   // TOKEN_FLOAT when lexer->decodeLiterals
+        uint32_t symbol;   // TOKEN_IDEN_GENERIC id from lexer->symbols (intern.h)
+    } value;
 } Token;
  
+/*
+ * A token lexed ahead by peekToken() and the lexer position right after
+ * it, which is where nextToken() leaves the lexer when it hands it out.
+ */
+typedef struct {
+    Token tok;
+    size_t pos;
+    size_t lines;
+    size_t cols;
+} LookaheadSlot;
+
+/*
+ * Checkpoint from lexerMark(). token counts tokens handed out by the
+ * lookahead ring, the rest is the lexer position at the mark.
+ */
+typedef struct {
+    size_t token;
+    size_t pos;
+    size_t lines;
+    size_t cols;
+} LexerMark;
+
+/* sinks one lexer holds, and tokens handed to them per call */
+#define LEXER_MAX_SINKS  4
+#define LEXER_SINK_BATCH 256
+
+/*
+ * Receives the tokens lexerDrive()/lexerRun() lexed, count at a time in
+ * input order, the last batch ends with the EOF token. A batch is cut
+ * short where an error has to reach errorFn in between. tokens points into
+ * the driver's batch and is only good until the sink returns. Returning
+ * false stops the run once every sink has seen the batch.
+ */
+typedef bool (*LexerSinkFn)(const Token *tokens, size_t count, void *userData);
+
+typedef struct {
+    LexerSinkFn fn;
+    void *userData;
+} LexerSink;
+
 typedef struct {
     const char *input;  /* Input string to tokenize */
+    size_t      length; /* bytes of input, a '\0' before that is an error not the end */
     size_t      pos;    /* Current position in input */
     bool ownsInput;     /* tracks if you need to delete buffer or not     */
+    size_t mappedSize;  /* length of the mmap backing input, 0 if not mapped */
     size_t cols;
     size_t lines;
     LexerErrorCallback errorFn;  // user-supplied callback
     void *errorUserData;         // user data passed back to callback
+    bool lazyPositions;  /* skip per character lines/cols, resolve them from lineStarts */
+    size_t *lineStarts;  /* offset of every line start, built on demand              */
+    size_t lineCount;    /* entries in lineStarts, 0 until the index is built        */
+    size_t lineCap;      /* entries allocated in lineStarts, kept by lexerReset      */
+    bool decodeLiterals; /* numHandler fills tok.value for numeric literals          */
+    struct InternTable *symbols; /* identifiers are interned here when set, may be shared */
+    char *readBuffer;    /* file contents land here, kept by lexerReset for reuse    */
+    size_t readCapacity; /* bytes allocated for readBuffer                           */
+    bool bufferDiagnostics; /* record errors, lexerFlushDiagnostics hands them to errorFn */
+    size_t maxErrors;    /* past this many errors skip to the next line, 0 = no limit */
+    size_t errorCount;   /* errors raised on this input, including the skipped ones   */
+    LexerDiagnostic *diagnostics; /* records waiting for lexerFlushDiagnostics        */
+    size_t diagnosticCount;
+    size_t diagnosticCap;
+    uint64_t triviaMask; /* LEXER_TRIVIA bits of the types nextToken skips, 0 = none */
+    size_t leadingTrivia; /* bytes skipped in front of the last token nextToken returned */
+    LookaheadSlot *ring; /* tokens lexed ahead, ringCap slots, a power of two         */
+    size_t ringCap;
+    size_t ringBase;     /* number of the oldest token kept, held back by marks       */
+    size_t ringNext;     /* number of the token nextToken hands out next              */
+    size_t ringEnd;      /* one past the last token lexed into the ring               */
+    size_t markDepth;    /* lexerMark calls not rewound or dropped yet                */
+    bool tableDriven;    /* lex through the generated tables, see lexTable()          */
+    LexerSink sinks[LEXER_MAX_SINKS]; /* called in order, kept by lexerReset          */
+    size_t sinkCount;
+    Token sinkCarry;     /* lexed by lexerDrive but held back when a sink stopped it */
+    bool sinkCarried;
+#ifdef LEXER_STATS
+    LexerStats stats;    /* kept across lexerReset, see lexerResetStats              */
+#endif
 } LexerInfo;
 
+/*
+ * Struct-of-arrays token stream filled by lexerTokenizeBatch. Each token is
+ * split across three parallel columns so later passes can walk just the
+ * column they need. Offsets index into lexer->input so inputs are limited
+ * to 4GB, bigger ones are refused by lexerTokenizeBatch/All.
+ */
+typedef struct {
+    uint8_t  *types;    /* TokenType of each token          */
+    uint32_t *offsets;  /* start of token in lexer->input   */
+    uint32_t *lengths;  /* length of token in bytes         */
+    uint32_t *symbols;  /* interned id per token, NULL unless the lexer interns */
+    struct Arena *arena; /* columns are allocated here when set, see arena.h */
+    void     *mapping;  /* columns point into this read only mapping, see cache.h */
+    size_t    mappingSize;
+    size_t    count;    /* tokens currently stored          */
+    size_t    capacity; /* tokens the columns can hold      */
+} TokenBuffer;
+
 
 
 
@@ -135,9 +345,23 @@ typedef struct {
  
 /* Lexer entry point */
 LexerInfo *lexerCreate(const char *inputString);
+LexerInfo *lexerCreateFromSpan(const char *input, size_t length);
 LexerInfo *lexerCreateFromFile(const char *filename);
 void lexerDestroy(LexerInfo *lex);
-void reportLexerError(LexerInfo *lex, const char *msg);
+void lexerInit(LexerInfo *lex, const char *inputString);
+void lexerInitSpan(LexerInfo *lex, const char *input, size_t length);
+void lexerRelease(LexerInfo *lex);
+void lexerReset(LexerInfo *lex, const char *inputString);
+void lexerResetSpan(LexerInfo *lex, const char *input, size_t length);
+bool lexerResetFromFile(LexerInfo *lex, const char *filename);
+void reportLexerError(LexerInfo *lex, LexerErrorCode code);
+void lexerReportAt(LexerInfo *lex, size_t offset, LexerErrorCode code);
+size_t lexerFlushDiagnostics(LexerInfo *lex);
+const char *lexerErrorMessage(LexerErrorCode code);
+
+//position lookups for lazyPositions mode
+bool lexerBuildLineIndex(LexerInfo *lxer);
+bool lexerResolvePosition(LexerInfo *lxer, size_t offset, size_t *line, size_t *col);
 
 //lexer helpers
 char peek(LexerInfo *lxer);
@@ -148,6 +372,10 @@ bool peekEoF(LexerInfo *lxer);
 
 //token functions and helpers
 Token nextToken(LexerInfo *lxer);
+Token peekToken(LexerInfo *lxer, size_t k);
+LexerMark lexerMark(LexerInfo *lxer);
+void lexerRewind(LexerInfo *lxer, LexerMark mark);
+void lexerDropMark(LexerInfo *lxer, LexerMark mark);
 Token numHandler(LexerInfo *lxer);
 Token opHandler(LexerInfo *lxer);
 Token identHandler(LexerInfo *lxer);
@@ -155,5 +383,27 @@ Token stringHandler(LexerInfo *lxer);
 Token delimHandler(LexerInfo *lxer);
 Token charHandler(LexerInfo *lxer);
 
+//batch tokenizing into a TokenBuffer
+bool tokenBufferInit(TokenBuffer *buf, size_t capacity);
+bool tokenBufferInitArena(TokenBuffer *buf, struct Arena *arena, size_t capacity);
+bool tokenBufferReserve(TokenBuffer *buf, size_t capacity);
+bool tokenBufferTrackSymbols(TokenBuffer *buf);
+void tokenBufferFree(TokenBuffer *buf);
+size_t lexerTokenizeBatch(LexerInfo *lxer, TokenBuffer *buf, size_t maxTokens);
+size_t lexerTokenizeAll(LexerInfo *lxer, TokenBuffer *buf);
+
+//push tokens to sinks instead of pulling them one by one
+bool lexerAddSink(LexerInfo *lxer, LexerSinkFn fn, void *userData);
+void lexerClearSinks(LexerInfo *lxer);
+bool lexerDrive(LexerInfo *lxer, size_t *delivered);
+size_t lexerRun(LexerInfo *lxer);
+
+//instrumentation, see LexerStats
+bool lexerGetStats(const LexerInfo *lxer, LexerStats *out);
+void lexerResetStats(LexerInfo *lxer);
+void lexerMergeStats(LexerStats *into, const LexerStats *from);
+
 void printTokenType(Token tok);
+bool printTokenSink(const Token *tokens, size_t count, void *userData);
+void printLexerStats(const LexerStats *stats);
 #endif 
\ No newline at end of file
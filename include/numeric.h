@@ -0,0 +1,22 @@
+/******************************************************************************
+* File:        numeric.h
+* Date:        04-06-26
+*
+* Description: Lexer project
+*
+* Notes: Header file for decoding numeric literal values during lexing
+******************************************************************************/
+#ifndef NUMERIC_H
+#define NUMERIC_H
+
+#include "lexer.h"
+
+/*
+ * Fills tok->value from the text of a TOKEN_INT, TOKEN_HEX, TOKEN_BIN,
+ * TOKEN_OCT or TOKEN_FLOAT token. Integers that don't fit in 64 bits are
+ * saturated to UINT64_MAX and floats out of range become HUGE_VAL, both
+ * set TOKEN_FLAG_OVERFLOW. Other token types are left alone.
+ */
+void decodeNumber(Token *tok);
+
+#endif /* NUMERIC_H */
@@ -0,0 +1,35 @@
+/******************************************************************************
+* File:        parallel.h
+* Date:        03-16-26
+*
+* Description: Lexer project
+*
+* Notes: Header file for lexing one large input on several threads
+******************************************************************************/
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "lexer.h"
+
+/*
+ * Inputs are only split when every thread gets at least this many bytes,
+ * below that starting threads costs more than it saves.
+ */
+#ifndef LEXER_PARALLEL_MIN_SEGMENT
+#define LEXER_PARALLEL_MIN_SEGMENT (256 * 1024)
+#endif
+
+/*
+ * Lexes the rest of lxer's input into buf using up to threads worker
+ * threads (0 picks one per online core). The tokens, errors and the final
+ * pos/lines/cols of lxer are the same as a sequential lexerTokenizeAll().
+ * Errors are delivered to lxer->errorFn (or buffered, see bufferDiagnostics)
+ * in order once all workers are done. A lexer with maxErrors set is lexed
+ * sequentially since recovery depends on every error before it.
+ * With lxer->symbols set all workers intern into that one table, so which
+ * id a name gets depends on timing but equal names always share an id.
+ * Returns the number of tokens appended.
+ */
+size_t lexerTokenizeParallel(LexerInfo *lxer, TokenBuffer *buf, unsigned threads);
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,34 @@
+/******************************************************************************
+* File:        relex.h
+* Date:        03-30-26
+*
+* Description: Lexer project
+*
+* Notes: Header file for incremental re-lexing after an edit
+******************************************************************************/
+#ifndef RELEX_H
+#define RELEX_H
+
+#include "lexer.h"
+
+/*
+ * Which tokens an edit touched. Tokens before first and after the replaced
+ * run are the old ones, only shifted by the size change of the edit.
+ */
+typedef struct {
+    size_t first;       /* index of the first token that was re-lexed  */
+    size_t removed;     /* old tokens replaced starting at first       */
+    size_t inserted;    /* new tokens now starting at first            */
+} RelexRange;
+
+/*
+ * Brings buf, the full token stream of the text before an edit (minus the
+ * types in lxer->triviaMask), up to date with the text after it. lxer->input must already hold the edited text.
+ * lxer->length still has the length before the edit, the size change is applied here.
+ * The edit replaced deletedLen bytes at editOffset with insertedLen bytes.
+ * Returns false if the buffer could not grow, buf is unchanged then.
+ */
+bool lexerRelex(LexerInfo *lxer, TokenBuffer *buf, size_t editOffset,
+                size_t deletedLen, size_t insertedLen, RelexRange *range);
+
+#endif /* RELEX_H */
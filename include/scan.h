@@ -0,0 +1,64 @@
+/******************************************************************************
+* File:        scan.h
+* Date:        03-02-26
+*
+* Description: Lexer project
+*
+* Notes: Header file for the wide scanning kernels the handlers use to skip
+*        over runs of bytes instead of stepping through them with advance()
+*        Every kernel stops at end, the bytes from end on are never part of
+*        a span even if they would match.
+******************************************************************************/
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Result of a scan. The caller moves the lexer by length bytes and uses the
+ * newline info to fix up lines/cols in one go.
+ */
+typedef struct {
+    size_t length;      /* bytes covered by the scan                    */
+    size_t newlines;    /* number of '\n' inside the span               */
+    size_t lastNewline; /* offset of the last '\n', only if newlines > 0 */
+} ScanSpan;
+
+/*
+ * Measures the run of whitespace (space, \t, \n, \v, \f, \r) starting at p.
+ * Stops on the first other byte or at end.
+ */
+ScanSpan scanWhitespace(const char *p, const char *end);
+
+/*
+ * Measures the rest of a line comment starting at p, up to but not
+ * including the next '\n' or end.
+ */
+ScanSpan scanLine(const char *p, const char *end);
+
+/*
+ * Measures the body of a block comment starting at p, up to but not
+ * including the first "*" "/" pair or end. Newlines in the body are
+ * counted.
+ */
+ScanSpan scanBlockComment(const char *p, const char *end);
+
+/*
+ * Measures the plain part of a string literal body starting at p, up to but
+ * not including the next '"', '\\', '\n' or end.
+ */
+ScanSpan scanStringBody(const char *p, const char *end);
+
+/*
+ * Counts the '\n' bytes in p[0..len).
+ */
+size_t scanCountNewlines(const char *p, size_t len);
+
+/*
+ * Writes the offset just past every '\n' in p[0..len) to starts, which must
+ * have room for scanCountNewlines(p, len) entries. Returns how many were
+ * written.
+ */
+size_t scanLineStarts(const char *p, size_t len, size_t *starts);
+
+#endif /* SCAN_H */
@@ -0,0 +1,55 @@
+/******************************************************************************
+* File:        stream.h
+* Date:        03-09-26
+*
+* Description: Lexer project
+*
+* Notes: Header file for the streaming (push) lexer. Input is fed in chunks
+*        and tokens are handed to a callback as soon as they are complete
+******************************************************************************/
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "lexer.h"
+
+/*
+ * Called once for every finished token. tok.start points into the stream's
+ * own buffer and is only valid until the callback returns.
+ */
+typedef void (*StreamTokenFn)(Token tok, void *userData);
+
+/* an error raised while lexing a token that may still be incomplete */
+typedef struct {
+    int line;
+    int col;
+    const char *msg;
+    size_t offset;      /* errChar as an offset into the stream buffer */
+} StreamError;
+
+typedef struct {
+    LexerInfo lexer;            /* lexes the buffered text, pos is always 0 between feeds */
+    char *buffer;               /* unfinished tail + newest chunk, null terminated */
+    size_t length;              /* bytes in buffer, not counting the '\0' */
+    size_t capacity;
+    StreamTokenFn tokenFn;
+    void *tokenUserData;
+    LexerErrorCallback errorFn; // user-supplied callback
+    void *errorUserData;        // user data passed back to callback
+    StreamError *pending;       /* errors for the token being lexed */
+    size_t pendingCount;
+    size_t pendingCap;
+    size_t tailScanned;         /* the unfinished token can't end before this byte */
+    size_t skippedTrivia;       /* bytes of lexer.triviaMask tokens since the last token */
+    bool finished;
+} LexerStream;
+
+/* =======================
+          Prototypes
+   ======================= */
+
+LexerStream *lexerStreamCreate(StreamTokenFn tokenFn, void *userData);
+void lexerStreamDestroy(LexerStream *stream);
+bool lexerFeed(LexerStream *stream, const char *chunk, size_t len);
+bool lexerFinish(LexerStream *stream);
+
+#endif /* STREAM_H */
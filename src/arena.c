@@ -0,0 +1,144 @@
+/******************************************************************************
+* File:        arena.c
+* Date:        04-20-26
+*
+* Description: Lexer project
+*
+* Notes: Bump allocator. An allocation is a pointer bump inside the front
+*        block, a new block is only taken when the front one is full. Reset
+*        splices the whole in-use list onto the spare list in one step so
+*        dropping everything a batch allocated costs the same no matter how
+*        much it was, and the next batch reuses the same (already faulted
+*        in) pages instead of going back to malloc.
+******************************************************************************/
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t used;
+    size_t size;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/*
+ * Sets up an empty arena. blockSize 0 picks ARENA_BLOCK_SIZE.
+ */
+void arenaInit(Arena *arena, size_t blockSize)
+{
+	arena->blocks = NULL;
+	arena->oldest = NULL;
+	arena->spare = NULL;
+	arena->blockSize = blockSize ? blockSize : ARENA_BLOCK_SIZE;
+}
+
+/*
+ * Puts a block with at least size free bytes at the front, from the spare
+ * list when one is big enough.
+ */
+static ArenaBlock *newBlock(Arena *arena, size_t size)
+{
+	ArenaBlock **link = &arena->spare;
+	ArenaBlock *block;
+
+	while (*link && (*link)->size < size)
+		link = &(*link)->next;
+
+	if (*link) {
+		block = *link;
+		*link = block->next;
+	} else {
+		if (size < arena->blockSize)
+			size = arena->blockSize;
+		block = malloc(sizeof(ArenaBlock) + size);
+		if (!block)
+			return NULL;
+		block->size = size;
+	}
+
+	block->used = 0;
+	block->next = arena->blocks;
+	if (!arena->blocks)
+		arena->oldest = block;
+	arena->blocks = block;
+	return block;
+}
+
+/*
+ * Returns size bytes aligned to ARENA_ALIGN, NULL when out of memory.
+ */
+void *arenaAlloc(Arena *arena, size_t size)
+{
+	ArenaBlock *block = arena->blocks;
+
+	size = ALIGN_UP(size ? size : 1);
+
+	if (!block || block->size - block->used < size) {
+		block = newBlock(arena, size);
+		if (!block)
+			return NULL;
+	}
+
+	block->used += size;
+	return block->data + block->used - size;
+}
+
+/*
+ * realloc() for arena memory. The newest allocation grows in place when
+ * its block has room, anything else is copied and the old bytes stay dead
+ * until the next reset.
+ */
+void *arenaGrow(Arena *arena, void *ptr, size_t oldSize, size_t newSize)
+{
+	ArenaBlock *block = arena->blocks;
+	void *grown;
+
+	if (!ptr)
+		return arenaAlloc(arena, newSize);
+	if (newSize <= oldSize)
+		return ptr;
+
+	if (block && (unsigned char *)ptr + ALIGN_UP(oldSize) == block->data + block->used &&
+	    (size_t)((unsigned char *)ptr - block->data) + ALIGN_UP(newSize) <= block->size) {
+		block->used = (size_t)((unsigned char *)ptr - block->data) + ALIGN_UP(newSize);
+		return ptr;
+	}
+
+	grown = arenaAlloc(arena, newSize);
+	if (grown)
+		memcpy(grown, ptr, oldSize);
+	return grown;
+}
+
+/*
+ * Drops every allocation at once. The blocks are kept for reuse.
+ */
+void arenaReset(Arena *arena)
+{
+	if (!arena->blocks)
+		return;
+
+	arena->oldest->next = arena->spare;
+	arena->spare = arena->blocks;
+	arena->blocks = NULL;
+	arena->oldest = NULL;
+}
+
+/*
+ * Returns all blocks to the system. The arena can be used again after.
+ */
+void arenaFree(Arena *arena)
+{
+	arenaReset(arena);
+
+	while (arena->spare) {
+		ArenaBlock *next = arena->spare->next;
+
+		free(arena->spare);
+		arena->spare = next;
+	}
+}
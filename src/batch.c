@@ -0,0 +1,345 @@
+/******************************************************************************
+* File:        batch.c
+* Date:        03-23-26
+*
+* Description: Lexer project
+*
+* Notes: Multi-file batch lexing. Files are sorted largest first and dealt
+*        round robin onto one deque per worker, so every deque is also
+*        largest first. A worker takes the biggest file left on its own
+*        deque and when that runs dry it steals the smallest file left on
+*        somebody else's, so the two ends of a deque are rarely fought over
+*        and the big files still start early. Every file gets its own
+*        LexerInfo and its results go into its own slot of the caller's
+*        array which keeps the output order fixed. Token columns come from
+*        an arena per worker, lexBatchFree() drops them all in one go.
+******************************************************************************/
+#define _DEFAULT_SOURCE
+
+#include "batch.h"
+#include "arena.h"
+#include "cache.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *jobs;       /* indices into the file array, largest first */
+    size_t head;        /* next job the owner takes                   */
+    size_t tail;        /* one past the job a thief takes             */
+} WorkQueue;
+
+/* one arena per worker, shared by every file of the batch through its arenas */
+struct BatchArenas {
+    unsigned count;
+    Arena arenas[];
+};
+
+typedef struct {
+    BatchFile *files;
+    struct BatchArenas *arenas;
+    WorkQueue *queues;
+    unsigned workers;
+    bool keepInput;
+    struct InternTable *symbols;
+    size_t maxErrors;
+    struct TokenCache *cache;
+} BatchPool;
+
+typedef struct {
+    BatchPool *pool;
+    unsigned id;
+} BatchWorker;
+
+/* what the files are sorted by, kept next to the index so qsort needs nothing else */
+typedef struct {
+    size_t size;
+    size_t index;
+} BatchOrder;
+
+/* ============================================================
+   ====================== WORK STEALING =======================
+   ============================================================ */
+
+static bool popOwn(WorkQueue *q, size_t *job)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->head < q->tail) {
+		*job = q->jobs[q->head++];
+		found = true;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return found;
+}
+
+static bool steal(WorkQueue *q, size_t *job)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->head < q->tail) {
+		*job = q->jobs[--q->tail];
+		found = true;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return found;
+}
+
+/* ============================================================
+   ========================= WORKERS ==========================
+   ============================================================ */
+
+/*
+ * Lexes a single file of the batch into its slot. With reuse set the file
+ * is loaded into that worker owned lexer instead of a new one, so its
+ * read buffer is recycled from file to file. The tokens are allocated from
+ * arena, only this worker may use it.
+ */
+static void lexOneFile(BatchFile *file, LexerInfo *reuse, Arena *arena, const BatchPool *pool)
+{
+	LexerInfo *lxer = reuse;
+	TokenCacheKey key;
+
+	if (reuse && !lexerResetFromFile(reuse, file->path))
+		lxer = NULL;
+	else if (!reuse)
+		lxer = lexerCreateFromFile(file->path);
+
+	if (!lxer || !tokenBufferInitArena(&file->tokens, arena, 0)) {
+		if (lxer != reuse)
+			lexerDestroy(lxer);
+		file->ok = false;
+		return;
+	}
+
+	/* errors are only counted, no callback and nothing buffered */
+	lxer->maxErrors = pool->maxErrors;
+	lxer->symbols = pool->symbols;
+
+	if (pool->cache) {
+		tokenCacheKeyFor(lxer, &key);
+		file->cached = tokenCacheLoad(pool->cache, &key, lxer, &file->tokens);
+	}
+	if (!file->cached) {
+		lexerTokenizeAll(lxer, &file->tokens);
+		if (pool->cache)
+			tokenCacheStore(pool->cache, &key, lxer, &file->tokens);
+	}
+
+	file->errors = lxer->errorCount;
+	file->lines = lxer->lines;
+	file->cols = lxer->cols;
+	file->ok = file->tokens.count > 0 &&
+	           file->tokens.types[file->tokens.count - 1] == TOKEN_EOF;
+
+	if (pool->keepInput) {
+		lxer->symbols = NULL;
+		file->lexer = lxer;
+	} else if (lxer != reuse) {
+		lexerDestroy(lxer);
+	}
+}
+
+static void *batchWorker(void *arg)
+{
+	BatchWorker *self = arg;
+	BatchPool *pool = self->pool;
+	LexerInfo scratch;
+	size_t job;
+
+	/* files that don't have to be kept all go through one lexer per worker */
+	lexerInit(&scratch, "");
+
+	for (;;) {
+		bool found = popOwn(&pool->queues[self->id], &job);
+
+		for (unsigned i = 1; !found && i < pool->workers; i++)
+			found = steal(&pool->queues[(self->id + i) % pool->workers], &job);
+
+		/* jobs are never added once the pool runs so empty means done */
+		if (!found)
+			break;
+
+		lexOneFile(&pool->files[job], pool->keepInput ? NULL : &scratch,
+		           &pool->arenas->arenas[self->id], pool);
+	}
+
+	lexerRelease(&scratch);
+	return NULL;
+}
+
+/* ============================================================
+   ======================= ENTRY POINT ========================
+   ============================================================ */
+
+static int bySizeDesc(const void *a, const void *b)
+{
+	const BatchOrder *oa = a;
+	const BatchOrder *ob = b;
+
+	if (oa->size != ob->size)
+		return oa->size < ob->size ? 1 : -1;
+	/* keep the sort stable so scheduling is the same every run */
+	return oa->index < ob->index ? -1 : 1;
+}
+
+/*
+ * Lexes every file of the array on up to threads workers (0 picks one per
+ * online core). When keepInput is set each file keeps its LexerInfo so the
+ * token text can still be read, otherwise the input is released as soon
+ * as the file is done. When symbols is set every file interns its
+ * identifiers into that one table and gets a symbols column in its tokens.
+ * maxErrors (0 for none) is set on every file's lexer so a file of garbage
+ * drops to skipping whole lines instead of erroring on every byte. With a
+ * cache, files lexed before are loaded from it and the rest are stored.
+ * Returns false if the pool could not be set up, failures of single files
+ * are reported through their ok flag.
+ */
+bool lexBatchRun(BatchFile *files, size_t count, unsigned threads, bool keepInput,
+                 struct InternTable *symbols, size_t maxErrors, struct TokenCache *cache)
+{
+	BatchPool pool;
+	BatchWorker *workers;
+	pthread_t *tids;
+	BatchOrder *order;
+	size_t perQueue;
+	unsigned w;
+
+	if (count == 0)
+		return true;
+
+	if (threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = online > 0 ? (unsigned)online : 1;
+	}
+	if (threads > count)
+		threads = (unsigned)count;
+
+	for (size_t i = 0; i < count; i++) {
+		struct stat st;
+
+		files[i].size = stat(files[i].path, &st) == 0 ? (size_t)st.st_size : 0;
+		files[i].tokens.types = NULL;
+		files[i].tokens.offsets = NULL;
+		files[i].tokens.lengths = NULL;
+		files[i].tokens.symbols = NULL;
+		files[i].tokens.arena = NULL;
+		files[i].tokens.mapping = NULL;
+		files[i].tokens.mappingSize = 0;
+		files[i].tokens.count = 0;
+		files[i].tokens.capacity = 0;
+		files[i].lines = 0;
+		files[i].cols = 0;
+		files[i].errors = 0;
+		files[i].lexer = NULL;
+		files[i].arenas = NULL;
+		files[i].cached = false;
+		files[i].ok = false;
+	}
+
+	order = malloc(count * sizeof(BatchOrder));
+	pool.arenas = malloc(sizeof(struct BatchArenas) + threads * sizeof(Arena));
+	pool.queues = calloc(threads, sizeof(WorkQueue));
+	workers = calloc(threads, sizeof(BatchWorker));
+	tids = calloc(threads, sizeof(pthread_t));
+	perQueue = (count + threads - 1) / threads;
+
+	if (!order || !pool.arenas || !pool.queues || !workers || !tids) {
+		free(order);
+		free(pool.arenas);
+		free(pool.queues);
+		free(workers);
+		free(tids);
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		order[i].size = files[i].size;
+		order[i].index = i;
+	}
+	qsort(order, count, sizeof(BatchOrder), bySizeDesc);
+
+	pool.arenas->count = threads;
+	for (w = 0; w < threads; w++)
+		arenaInit(&pool.arenas->arenas[w], 0);
+	for (size_t i = 0; i < count; i++)
+		files[i].arenas = pool.arenas;
+
+	pool.files = files;
+	pool.workers = threads;
+	pool.keepInput = keepInput;
+	pool.symbols = symbols;
+	pool.maxErrors = maxErrors;
+	pool.cache = cache;
+
+	/* deal the sorted files round robin so every queue is largest first */
+	for (w = 0; w < threads; w++) {
+		pool.queues[w].jobs = malloc(perQueue * sizeof(size_t));
+		pthread_mutex_init(&pool.queues[w].lock, NULL);
+	}
+	for (size_t i = 0; i < count; i++) {
+		WorkQueue *q = &pool.queues[i % threads];
+
+		if (q->jobs)
+			q->jobs[q->tail++] = order[i].index;
+		else
+			lexOneFile(&files[order[i].index], NULL, &pool.arenas->arenas[0], &pool);
+	}
+
+	for (w = 0; w < threads; w++) {
+		workers[w].pool = &pool;
+		workers[w].id = w;
+	}
+
+	/* worker 0 is the calling thread */
+	for (w = 1; w < threads; w++) {
+		if (pthread_create(&tids[w], NULL, batchWorker, &workers[w]) != 0)
+			tids[w] = 0;
+	}
+	batchWorker(&workers[0]);
+	for (w = 1; w < threads; w++) {
+		if (tids[w])
+			pthread_join(tids[w], NULL);
+	}
+
+	for (w = 0; w < threads; w++) {
+		pthread_mutex_destroy(&pool.queues[w].lock);
+		free(pool.queues[w].jobs);
+	}
+	free(pool.queues);
+	free(workers);
+	free(tids);
+	free(order);
+	return true;
+}
+
+/*
+ * Releases the results of a batch. The file paths stay with the caller.
+ * Token columns go with their worker arenas, only lexers and cached
+ * mappings are released file by file.
+ */
+void lexBatchFree(BatchFile *files, size_t count)
+{
+	struct BatchArenas *arenas = NULL;
+
+	for (size_t i = 0; i < count; i++) {
+		tokenBufferFree(&files[i].tokens);
+		lexerDestroy(files[i].lexer);
+		files[i].lexer = NULL;
+		if (files[i].arenas)
+			arenas = files[i].arenas;
+		files[i].arenas = NULL;
+	}
+
+	if (arenas) {
+		for (unsigned w = 0; w < arenas->count; w++)
+			arenaFree(&arenas->arenas[w]);
+		free(arenas);
+	}
+}
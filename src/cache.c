@@ -0,0 +1,458 @@
+/******************************************************************************
+* File:        cache.c
+* Date:        05-11-26
+*
+* Description: Lexer project
+*
+* Notes: On disk token cache. Every entry is one file named after the hash
+*        of the input it was lexed from, holding a header and the offsets,
+*        lengths and types columns back to back. A hit maps the file and
+*        points a TokenBuffer straight at the columns, so an unchanged
+*        input costs a hash and an mmap instead of a lex. Entries are
+*        written to a temporary file and renamed into place so a reader
+*        never sees half of one, and the directory is trimmed oldest first
+*        once it grows past its size limit. Entries are only valid on the
+*        machine that wrote them.
+******************************************************************************/
+#define _DEFAULT_SOURCE
+
+#include "cache.h"
+#include "intern.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC     "BCPLTOK"
+#define CACHE_FORMAT    2
+#define CACHE_SUFFIX    ".tok"
+/* hits on entries older than this move them back to the young end */
+#define CACHE_TOUCH_AGE (60 * 60)
+
+typedef struct {
+    char magic[8];
+    uint32_t format;        /* CACHE_FORMAT                          */
+    uint32_t lexerVersion;  /* LEXER_VERSION                         */
+    uint64_t hash[2];
+    uint64_t inputLength;
+    uint64_t triviaMask;
+    uint64_t count;         /* tokens in each column                 */
+    uint64_t lines;         /* lexer lines/cols after the EOF token  */
+    uint64_t cols;
+    uint64_t flags;         /* CACHE_LAZY_POSITIONS, also keeps the
+                               columns 16 byte aligned               */
+} CacheHeader;
+
+/* lines/cols were left by a lexer in lazyPositions mode */
+#define CACHE_LAZY_POSITIONS 0x1
+
+struct TokenCache {
+    char *dir;
+    size_t maxBytes;
+    size_t totalBytes;      /* size of every entry, as last counted  */
+    pthread_mutex_t lock;   /* totalBytes and trimming               */
+};
+
+/* ============================================================
+   ========================= HASHING ==========================
+   ============================================================ */
+
+#define K1 0x9e3779b97f4a7c15ULL
+#define K2 0xc2b2ae3d27d4eb4fULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t finalMix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+ * Two independent 64 bit lanes over 16 byte steps. Not cryptographic,
+ * only meant to tell edited files apart.
+ */
+static void hashContent(const char *p, size_t len, uint64_t seed, uint64_t out[2])
+{
+	uint64_t a = seed ^ K1;
+	uint64_t b = rotl64(seed, 32) ^ K2 ^ len;
+	unsigned char tail[16] = {0};
+	size_t i = 0;
+	uint64_t x, y;
+
+	for (; i + 16 <= len; i += 16) {
+		memcpy(&x, p + i, 8);
+		memcpy(&y, p + i + 8, 8);
+		a = rotl64(a ^ x * K1, 31) * K2;
+		b = rotl64(b ^ y * K2, 29) * K1;
+	}
+
+	memcpy(tail, p + i, len - i);
+	memcpy(&x, tail, 8);
+	memcpy(&y, tail + 8, 8);
+	a = rotl64(a ^ x * K1, 31) * K2;
+	b = rotl64(b ^ y * K2, 29) * K1;
+
+	a ^= len;
+	out[0] = finalMix(a + b);
+	out[1] = finalMix(b ^ rotl64(a, 17));
+}
+
+/*
+ * Works out what lxer's input is cached under. Always hashes the whole
+ * input, not just what is left of it.
+ */
+void tokenCacheKeyFor(const LexerInfo *lxer, TokenCacheKey *key)
+{
+	uint64_t seed = finalMix(lxer->triviaMask ^ ((uint64_t)LEXER_VERSION << 56));
+
+	/* a lazy lexer leaves different lines/cols behind, it gets its own entries */
+	seed = finalMix(seed + lxer->lazyPositions);
+	key->length = lxer->length;
+	key->triviaMask = lxer->triviaMask;
+	key->lazyPositions = lxer->lazyPositions;
+	hashContent(lxer->input, key->length, seed, key->hash);
+}
+
+/* ============================================================
+   ========================= ENTRIES ==========================
+   ============================================================ */
+
+static void entryPath(const TokenCache *cache, const TokenCacheKey *key, char *path, size_t size)
+{
+	snprintf(path, size, "%s/%016llx%016llx" CACHE_SUFFIX, cache->dir,
+	         (unsigned long long)key->hash[0], (unsigned long long)key->hash[1]);
+}
+
+static size_t columnsSize(size_t count)
+{
+	return count * (2 * sizeof(uint32_t) + sizeof(uint8_t));
+}
+
+/*
+ * Whether the columns of an entry describe a token stream of an input of
+ * inputLength bytes: known types, every token inside the input and one EOF
+ * token last, sitting on the terminator right after the input. The
+ * consumers read input + offset without checking, so a damaged or forged
+ * entry must not get past this.
+ */
+static bool columnsValid(const CacheHeader *head)
+{
+	const uint32_t *offsets = (const uint32_t *)(head + 1);
+	const uint32_t *lengths = offsets + head->count;
+	const uint8_t *types = (const uint8_t *)(lengths + head->count);
+	size_t last = head->count - 1;
+
+	if (head->count == 0 || types[last] != TOKEN_EOF ||
+	    offsets[last] != head->inputLength || lengths[last] > 1)
+		return false;
+
+	for (size_t i = 0; i < last; i++) {
+		if (types[i] >= TOKEN_COUNT || types[i] == TOKEN_EOF ||
+		    offsets[i] > head->inputLength || lengths[i] > head->inputLength - offsets[i])
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Looks key up. On a hit out is replaced by a read only view of the cached
+ * columns (it is copied out the first time it has to grow), the symbols
+ * column is rebuilt if lxer interns, and lxer is left at the end of its
+ * input as if it had lexed it. Returns false on a miss, lxer is untouched
+ * then.
+ */
+bool tokenCacheLoad(TokenCache *cache, const TokenCacheKey *key, LexerInfo *lxer, TokenBuffer *out)
+{
+	char path[4096];
+	struct stat st;
+	const CacheHeader *head;
+	void *map;
+	int fd;
+
+	entryPath(cache, key, path, sizeof(path));
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+		close(fd);
+		return false;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map != MAP_FAILED && time(NULL) - st.st_mtime > CACHE_TOUCH_AGE)
+		futimens(fd, NULL);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	/* anything that does not match exactly is a miss, store overwrites it */
+	head = map;
+	if (memcmp(head->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+	    head->format != CACHE_FORMAT || head->lexerVersion != LEXER_VERSION ||
+	    head->hash[0] != key->hash[0] || head->hash[1] != key->hash[1] ||
+	    head->inputLength != key->length || head->triviaMask != key->triviaMask ||
+	    !(head->flags & CACHE_LAZY_POSITIONS) != !key->lazyPositions ||
+	    head->count > ((size_t)st.st_size - sizeof(CacheHeader)) / columnsSize(1) ||
+	    (size_t)st.st_size != sizeof(CacheHeader) + columnsSize(head->count) ||
+	    !columnsValid(head)) {
+		munmap(map, (size_t)st.st_size);
+		return false;
+	}
+
+	tokenBufferFree(out);
+	out->arena = NULL;
+	out->offsets = (uint32_t *)(head + 1);
+	out->lengths = out->offsets + head->count;
+	out->types = (uint8_t *)(out->lengths + head->count);
+	out->count = head->count;
+	out->capacity = head->count;
+	out->mapping = map;
+	out->mappingSize = (size_t)st.st_size;
+
+	/* ids are only good for one table, they are never stored */
+	if (lxer->symbols) {
+		if (!tokenBufferTrackSymbols(out)) {
+			tokenBufferFree(out);
+			return false;
+		}
+		for (size_t i = 0; i < out->count; i++) {
+			if (out->types[i] == TOKEN_IDEN_GENERIC)
+				out->symbols[i] = intern(lxer->symbols, lxer->input + out->offsets[i],
+				                         out->lengths[i]);
+		}
+	}
+
+	lxer->pos = key->length;
+	lxer->lines = head->lines;
+	lxer->cols = head->cols;
+	return true;
+}
+
+/*
+ * Writes all of size bytes, retrying short writes.
+ */
+static bool writeAll(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+
+	while (size) {
+		ssize_t n = write(fd, p, size);
+
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+/* ============================================================
+   ======================== TRIMMING ==========================
+   ============================================================ */
+
+typedef struct {
+    time_t mtime;
+    size_t size;
+    char name[64];
+} CacheFile;
+
+static int byAge(const void *a, const void *b)
+{
+	const CacheFile *x = a, *y = b;
+
+	if (x->mtime != y->mtime)
+		return x->mtime < y->mtime ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+/*
+ * Counts what the directory holds and, when that is over the limit,
+ * removes entries oldest first until it is under three quarters of it so
+ * the next few stores don't trim again. Caller holds the lock.
+ */
+static void trimCache(TokenCache *cache)
+{
+	DIR *dir = opendir(cache->dir);
+	struct dirent *ent;
+	CacheFile *files = NULL;
+	size_t count = 0, cap = 0, total = 0;
+	char path[4096];
+
+	if (!dir)
+		return;
+
+	while ((ent = readdir(dir)) != NULL) {
+		size_t len = strlen(ent->d_name);
+		struct stat st;
+
+		/* left behind by a store that never got to its rename */
+		if (strncmp(ent->d_name, "tmp.", 4) == 0) {
+			snprintf(path, sizeof(path), "%s/%s", cache->dir, ent->d_name);
+			if (stat(path, &st) == 0 && time(NULL) - st.st_mtime > CACHE_TOUCH_AGE)
+				unlink(path);
+			continue;
+		}
+
+		if (len < sizeof(CACHE_SUFFIX) || len >= sizeof(files->name) ||
+		    strcmp(ent->d_name + len - (sizeof(CACHE_SUFFIX) - 1), CACHE_SUFFIX) != 0)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", cache->dir, ent->d_name);
+		if (stat(path, &st) != 0)
+			continue;
+
+		if (count == cap) {
+			size_t grown = cap ? cap * 2 : 64;
+			CacheFile *more = realloc(files, grown * sizeof(*more));
+
+			if (!more)
+				break;
+			files = more;
+			cap = grown;
+		}
+		files[count].mtime = st.st_mtime;
+		files[count].size = (size_t)st.st_size;
+		memcpy(files[count].name, ent->d_name, len + 1);
+		count++;
+		total += (size_t)st.st_size;
+	}
+	closedir(dir);
+
+	if (total > cache->maxBytes) {
+		size_t target = cache->maxBytes / 4 * 3;
+
+		qsort(files, count, sizeof(*files), byAge);
+		for (size_t i = 0; i < count && total > target; i++) {
+			snprintf(path, sizeof(path), "%s/%s", cache->dir, files[i].name);
+			if (unlink(path) == 0)
+				total -= files[i].size;
+		}
+	}
+
+	cache->totalBytes = total;
+	free(files);
+}
+
+/*
+ * Stores the token stream lxer produced for the input key was made from.
+ * Only complete streams of inputs without errors are kept, errors have to
+ * be reported again on every build and the cache has no way to replay
+ * them. The symbols column is not stored. Returns true if an entry was
+ * written.
+ */
+bool tokenCacheStore(TokenCache *cache, const TokenCacheKey *key, const LexerInfo *lxer,
+                     const TokenBuffer *buf)
+{
+	char tmp[4096], path[4096];
+	CacheHeader head;
+	size_t size;
+	bool ok;
+	int fd;
+
+	if (lxer->errorCount || buf->count == 0 || key->length > UINT32_MAX ||
+	    buf->types[buf->count - 1] != TOKEN_EOF)
+		return false;
+
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	head.format = CACHE_FORMAT;
+	head.lexerVersion = LEXER_VERSION;
+	head.hash[0] = key->hash[0];
+	head.hash[1] = key->hash[1];
+	head.inputLength = key->length;
+	head.triviaMask = key->triviaMask;
+	head.count = buf->count;
+	head.lines = lxer->lines;
+	head.cols = lxer->cols;
+	head.flags = key->lazyPositions ? CACHE_LAZY_POSITIONS : 0;
+
+	snprintf(tmp, sizeof(tmp), "%s/tmp.XXXXXX", cache->dir);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return false;
+
+	ok = writeAll(fd, &head, sizeof(head)) &&
+	     writeAll(fd, buf->offsets, buf->count * sizeof(uint32_t)) &&
+	     writeAll(fd, buf->lengths, buf->count * sizeof(uint32_t)) &&
+	     writeAll(fd, buf->types, buf->count * sizeof(uint8_t));
+	ok = close(fd) == 0 && ok;
+
+	/* rename is atomic, a reader sees the old entry, no entry or this one */
+	entryPath(cache, key, path, sizeof(path));
+	if (!ok || rename(tmp, path) != 0) {
+		unlink(tmp);
+		return false;
+	}
+
+	size = sizeof(head) + columnsSize(buf->count);
+	pthread_mutex_lock(&cache->lock);
+	cache->totalBytes += size;
+	if (cache->totalBytes > cache->maxBytes)
+		trimCache(cache);
+	pthread_mutex_unlock(&cache->lock);
+	return true;
+}
+
+/* ============================================================
+   ======================== LIFECYCLE =========================
+   ============================================================ */
+
+/*
+ * Opens the cache in dir, creating the directory if needed. maxBytes 0
+ * picks TOKEN_CACHE_DEFAULT_LIMIT. One cache can be shared by any number
+ * of threads. Returns NULL if dir is not usable.
+ */
+TokenCache *tokenCacheOpen(const char *dir, size_t maxBytes)
+{
+	TokenCache *cache;
+	struct stat st;
+
+	mkdir(dir, 0777);
+	if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+		return NULL;
+
+	cache = malloc(sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->dir = strdup(dir);
+	if (!cache->dir) {
+		free(cache);
+		return NULL;
+	}
+	cache->maxBytes = maxBytes ? maxBytes : TOKEN_CACHE_DEFAULT_LIMIT;
+	cache->totalBytes = 0;
+	pthread_mutex_init(&cache->lock, NULL);
+
+	/* count what is there already, a smaller limit than last time trims now */
+	trimCache(cache);
+	return cache;
+}
+
+/*
+ * Closes a cache. Buffers loaded from it stay valid.
+ */
+void tokenCacheClose(TokenCache *cache)
+{
+	if (!cache)
+		return;
+
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->dir);
+	free(cache);
+}
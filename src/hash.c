@@ -1,10 +1,12 @@
-/*
-* File:        lexer.c
+/***********************************************************************
+* File:        hash.c
 * Date:        02-18-26
 *
 * Description: Lexer project
 *
-* Notes: keyword perfect hash produced by gperf version 3.1
+* Notes: keyword perfect hash produced by gperf version 3.1. The wordlist
+*        was changed by hand to store the length and keyword id of every
+*        entry so a hit can be checked without strlen/strncmp
 * 
 ***********************************************************************/
 
@@ -15,7 +17,7 @@
  
 static unsigned int hash(const char *str, size_t len) 
 {
-    static unsigned char asso_values[] = {
+    static const unsigned char asso_values[256] = {
         68, 68, 68, 68, 68, 68, 68, 68, 68, 68,
         68, 68, 68, 68, 68, 68, 68, 68, 68, 68,
         68, 68, 68, 68, 68, 68, 68, 68, 68, 68,
@@ -40,6 +42,7 @@ static unsigned int hash(const char *str, size_t len)
         68, 68, 68, 68, 68, 68, 68, 68, 68, 68,
         68, 68, 68, 68, 68, 68, 68, 68, 68, 68,
         68, 68, 68, 68, 68, 68, 68, 68, 68, 68,
+        68, 68, 68, 68, 68, 68, 68, 68, 68, 68,
         68, 68, 68, 68, 68, 68
     };
  
@@ -47,88 +50,187 @@ static unsigned int hash(const char *str, size_t len)
         asso_values[(unsigned char)str[1]] +
         asso_values[(unsigned char)str[0]];
 }
- 
-bool lookUp(const char *str, size_t len) 
+
+/*
+ * Keywords are at most MAX_WORD_LENGTH (8) bytes so a whole keyword fits in
+ * one uint64_t. name is zero padded and is not NUL terminated when the
+ * keyword is exactly 8 letters long.
+ */
+typedef struct {
+    char    name[MAX_WORD_LENGTH];
+    uint8_t len;
+    Keyword id;
+} KeywordEntry;
+
+/*
+ * Keeps the first len bytes of a little/big endian word loaded from memory.
+ */
+static inline uint64_t keepBytes(uint64_t word, size_t len)
+{
+    if (len >= 8)
+        return word;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return word & ~(~(uint64_t)0 >> (8 * len));
+#else
+    return word & (((uint64_t)1 << (8 * len)) - 1);
+#endif
+}
+
+/*
+ * Loads the first len (<= 8) bytes of str into a word with the rest zeroed,
+ * reading nothing past them.
+ */
+static inline uint64_t loadWord(const char *str, size_t len)
+{
+    uint64_t word = 0;
+
+    memcpy(&word, str, len);
+    return word;
+}
+
+/*
+ * loadWord() with a full 8 byte load unless it could run over the end of a
+ * page, the bytes past the identifier are masked off so their value never
+ * matters. The load may reach past the object str points into, which is
+ * fine for the lexer's padded input but not for AddressSanitizer, so the
+ * function is left uninstrumented.
+ */
+#if defined(__GNUC__)
+typedef uint64_t __attribute__((may_alias, aligned(1))) UnalignedWord;
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+NO_SANITIZE_ADDRESS
+static uint64_t loadWordWide(const char *str, size_t len)
+{
+    uint64_t word;
+
+    if (((uintptr_t)str & 4095) > 4096 - 8)
+        return loadWord(str, len);
+#if defined(__GNUC__)
+    word = *(const UnalignedWord *)str;   /* memcpy would go through the ASan interceptor */
+#else
+    memcpy(&word, str, 8);
+#endif
+    return keepBytes(word, len);
+}
+
+static const KeywordEntry wordlist[] = {
+    {"",         0, KEYWRD_NONE},
+    {"",         0, KEYWRD_NONE},
+    {"OR",       2, KEYWRD_OR},
+    {"FOR",      3, KEYWRD_FOR},
+    {"LOOP",     4, KEYWRD_LOOP},
+    {"",         0, KEYWRD_NONE},
+    {"",         0, KEYWRD_NONE},
+    {"TO",       2, KEYWRD_TO},
+    {"",         0, KEYWRD_NONE},
+    {"TRUE",     4, KEYWRD_TRUE},
+    {"FALSE",    5, KEYWRD_FALSE},
+    {"",         0, KEYWRD_NONE},
+    {"GR",       2, KEYWRD_GR},
+    {"MANIFEST", 8, KEYWRD_MANIFEST},
+    {"GOTO",     4, KEYWRD_GOTO},
+    {"TABLE",    5, KEYWRD_TABLE},
+    {"GLOBAL",   6, KEYWRD_GLOBAL},
+    {"LS",       2, KEYWRD_LS},
+    {"LET",      3, KEYWRD_LET},
+    {"ELSE",     4, KEYWRD_ELSE},
+    {"LEVEL",    5, KEYWRD_LEVEL},
+    {"RETURN",   6, KEYWRD_RETURN},
+    {"RESULTS",  7, KEYWRD_RESULTS},
+    {"RESULTIS", 8, KEYWRD_RESULTIS},
+    {"TEST",     4, KEYWRD_TEST},
+    {"",         0, KEYWRD_NONE},
+    {"STATIC",   6, KEYWRD_STATIC},
+    {"GE",       2, KEYWRD_GE},
+    {"GET",      3, KEYWRD_GET},
+    {"THEN",     4, KEYWRD_THEN},
+    {"",         0, KEYWRD_NONE},
+    {"WRITEF",   6, KEYWRD_WRITEF},
+    {"IF",       2, KEYWRD_IF},
+    {"NOT",      3, KEYWRD_NOT},
+    {"CASE",     4, KEYWRD_CASE},
+    {"VALOF",    5, KEYWRD_VALOF},
+    {"",         0, KEYWRD_NONE},
+    {"SECTION",  7, KEYWRD_SECTION},
+    {"AND",      3, KEYWRD_AND},
+    {"",         0, KEYWRD_NONE},
+    {"UNTIL",    5, KEYWRD_UNTIL},
+    {"UNLESS",   6, KEYWRD_UNLESS},
+    {"DO",       2, KEYWRD_DO},
+    {"VEC",      3, KEYWRD_VEC},
+    {"",         0, KEYWRD_NONE},
+    {"BREAK",    5, KEYWRD_BREAK},
+    {"SWITCH",   6, KEYWRD_SWITCH},
+    {"NE",       2, KEYWRD_NE},
+    {"SWITCHON", 8, KEYWRD_SWITCHON},
+    {"",         0, KEYWRD_NONE},
+    {"WHILE",    5, KEYWRD_WHILE},
+    {"",         0, KEYWRD_NONE},
+    {"BY",       2, KEYWRD_BY},
+    {"",         0, KEYWRD_NONE},
+    {"",         0, KEYWRD_NONE},
+    {"",         0, KEYWRD_NONE},
+    {"",         0, KEYWRD_NONE},
+    {"BE",       2, KEYWRD_BE},
+    {"",         0, KEYWRD_NONE},
+    {"",         0, KEYWRD_NONE},
+    {"",         0, KEYWRD_NONE},
+    {"",         0, KEYWRD_NONE},
+    {"DEFAULT",  7, KEYWRD_DEFAULT},
+    {"",         0, KEYWRD_NONE},
+    {"INTO",     4, KEYWRD_INTO},
+    {"",         0, KEYWRD_NONE},
+    {"",         0, KEYWRD_NONE},
+    {"EQ",       2, KEYWRD_EQ}
+};
+
+/*
+ * Returns the table entry str would have to match, NULL if its length or
+ * first letters already rule every keyword out.
+ */
+static inline const KeywordEntry *candidate(const char *str, size_t len)
 {
-    static const char *wordlist[] = {
-        "", "",
-        "OR",
-        "FOR",
-        "LOOP",
-        "", "",
-        "TO",
-        "",
-        "TRUE",
-        "FALSE",
-        "",
-        "GR",
-        "MANIFEST",
-        "GOTO",
-        "TABLE",
-        "GLOBAL",
-        "LS",
-        "LET",
-        "ELSE",
-        "LEVEL",
-        "RETURN",
-        "RESULTS",
-        "RESULTIS",
-        "TEST",
-        "",
-        "STATIC",
-        "GE",
-        "GET",
-        "THEN",
-        "",
-        "WRITEF",
-        "IF",
-        "NOT",
-        "CASE",
-        "VALOF",
-        "",
-        "SECTION",
-        "AND",
-        "",
-        "UNTIL",
-        "UNLESS",
-        "DO",
-        "VEC",
-        "",
-        "BREAK",
-        "SWITCH",
-        "NE",
-        "SWITCHON",
-        "",
-        "WHILE",
-        "",
-        "BY",
-        "", "", "", "",
-        "BE",
-        "", "", "", "",
-        "DEFAULT",
-        "",
-        "INTO",
-        "", "",
-        "EQ"
-    };
- 
     if (len <= MAX_WORD_LENGTH && len >= MIN_WORD_LENGTH) {
         unsigned int key = hash(str, len);
- 
-        if (key <= MAX_HASH_VALUE) {
-            const char *s = wordlist[key];
- 
-            //chnage the orignal gperf struct to store the length of the string
-            //see what the performance impact of hardcoded len vs calling strlen
-            if (strncmp(wordlist[key], s, strlen(wordlist[key])) == 0)
-                /*
-                * Originally:
-                * if (*str == *s && !strcmp(str + 1, s + 1))
-                * might need to fix this later on. Needs testing
-                */
-                return 1;
-        }
+
+        if (key <= MAX_HASH_VALUE && wordlist[key].len == len)
+            return &wordlist[key];
     }
- 
-    return 0;
-}
\ No newline at end of file
+    return NULL;
+}
+
+static inline uint64_t entryWord(const KeywordEntry *entry)
+{
+    uint64_t want;
+
+    memcpy(&want, entry->name, sizeof(want));
+    return want;
+}
+
+/*
+ * Returns the keyword id for str or KEYWRD_NONE if it is not a keyword.
+ */
+Keyword lookUp(const char *str, size_t len) 
+{
+    const KeywordEntry *entry = candidate(str, len);
+
+    if (entry && loadWord(str, len) == entryWord(entry))
+        return entry->id;
+    return KEYWRD_NONE;
+}
+
+/*
+ * lookUp() for the lexer's own input, see hash.h.
+ */
+Keyword lookUpPadded(const char *str, size_t len)
+{
+    const KeywordEntry *entry = candidate(str, len);
+
+    if (entry && loadWordWide(str, len) == entryWord(entry))
+        return entry->id;
+    return KEYWRD_NONE;
+}
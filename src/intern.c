@@ -0,0 +1,364 @@
+/******************************************************************************
+* File:        intern.c
+* Date:        04-13-26
+*
+* Description: Lexer project
+*
+* Notes: Identifier interning shared by any number of lexers and threads.
+*        The table is an array of bucket chains. Lookups never lock, they
+*        follow the chain from an acquire load of the bucket head and an
+*        entry is fully written before it is published at the head, so a
+*        reader sees either the old chain or the complete new entry.
+*        Inserts take one of a set of striped locks picked by the bucket,
+*        check the chain again and push the new entry. Every stripe keeps
+*        its own arena the entries are carved from so inserts on different
+*        stripes don't share an allocator either.
+*
+*        Once there are twice as many names as buckets the bucket array is
+*        doubled with every stripe locked. Entries are never relinked, the
+*        new array gets fresh copies pointing at the same name and ids keep
+*        resolving to the original. Readers still on the old array see a
+*        complete old chain, at worst they miss a name added since and fall
+*        through to the locked path which looks again in the new array. Old
+*        arrays are kept until the table is destroyed, together they are no
+*        bigger than the current one.
+*
+*        Ids come from one atomic counter. The id -> entry map is a fixed
+*        directory of lazily allocated chunks so it never has to move while
+*        other threads are reading it.
+******************************************************************************/
+#include "intern.h"
+#include "arena.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_STRIPES     64
+#define INTERN_MIN_BUCKETS 1024
+#define INTERN_CHUNK_SIZE  ((size_t)1 << INTERN_CHUNK_BITS)
+
+typedef struct InternEntry {
+    struct InternEntry *next;   /* written before the entry is published */
+    uint32_t hash;
+    uint32_t id;
+    uint32_t length;
+    const char *name;           /* '\0' terminated copy, shared with the
+                                   copies a resize makes of the entry   */
+} InternEntry;
+
+/* padded so two stripes never share a cache line */
+typedef struct {
+    alignas(64) pthread_mutex_t lock;
+    Arena names;
+} InternStripe;
+
+typedef _Atomic(InternEntry *) InternSlot;
+
+/* one generation of the bucket array, replaced as a whole when it grows */
+typedef struct InternIndex {
+    struct InternIndex *retired;    /* the generation this one replaced */
+    unsigned shift;                 /* 32 - log2(bucket count)          */
+    InternSlot buckets[];
+} InternIndex;
+
+struct InternTable {
+    _Atomic(InternIndex *) index;
+    InternStripe stripes[INTERN_STRIPES];
+    _Atomic(InternSlot *) chunks[INTERN_MAX_CHUNKS];
+    atomic_size_t nextId;
+};
+
+/* ============================================================
+   ========================= HELPERS ==========================
+   ============================================================ */
+
+static inline size_t bucketOf(const InternIndex *index, uint32_t hash)
+{
+	/* fibonacci hashing spreads the FNV bits over the top of the word */
+	return (size_t)((hash * 2654435769u) >> index->shift);
+}
+
+static InternIndex *newIndex(unsigned bits)
+{
+	InternIndex *index = calloc(1, sizeof(InternIndex) + ((size_t)1 << bits) * sizeof(InternSlot));
+
+	if (index)
+		index->shift = 32 - bits;
+	return index;
+}
+
+static const InternEntry *findIn(const InternEntry *e, const char *name, size_t length, uint32_t hash)
+{
+	for (; e; e = e->next) {
+		if (e->hash == hash && e->length == length && memcmp(e->name, name, length) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/*
+ * Points directory slot id at entry, allocating the chunk on first use.
+ */
+static bool publishId(InternTable *table, uint32_t id, InternEntry *entry)
+{
+	size_t c = id >> INTERN_CHUNK_BITS;
+	InternSlot *chunk = atomic_load_explicit(&table->chunks[c], memory_order_acquire);
+
+	if (!chunk) {
+		InternSlot *fresh = calloc(INTERN_CHUNK_SIZE, sizeof(InternSlot));
+
+		if (!fresh)
+			return false;
+		/* several stripes can race for the same chunk, the loser frees its copy */
+		if (atomic_compare_exchange_strong_explicit(&table->chunks[c], &chunk, fresh,
+		                                            memory_order_acq_rel, memory_order_acquire))
+			chunk = fresh;
+		else
+			free(fresh);
+	}
+
+	atomic_store_explicit(&chunk[id & (INTERN_CHUNK_SIZE - 1)], entry, memory_order_release);
+	return true;
+}
+
+/*
+ * Doubles the bucket array once the names outgrow it. Runs with every
+ * stripe locked so no insert can land in the array being copied, the
+ * entries are copied into the stripe arenas of their new buckets.
+ */
+static void growTable(InternTable *table)
+{
+	InternIndex *old, *grown;
+	unsigned bits;
+
+	for (size_t i = 0; i < INTERN_STRIPES; i++)
+		pthread_mutex_lock(&table->stripes[i].lock);
+
+	old = atomic_load_explicit(&table->index, memory_order_relaxed);
+	bits = 32 - old->shift;
+
+	/* another thread may have grown it while we waited for the locks */
+	if (internCount(table) <= (size_t)2 << bits || bits >= 30)
+		goto out;
+
+	grown = newIndex(bits + 1);
+	if (!grown)
+		goto out;
+
+	for (size_t b = 0; b < (size_t)1 << bits; b++) {
+		const InternEntry *e = atomic_load_explicit(&old->buckets[b], memory_order_relaxed);
+
+		for (; e; e = e->next) {
+			size_t nb = bucketOf(grown, e->hash);
+			InternEntry *copy = arenaAlloc(&table->stripes[nb & (INTERN_STRIPES - 1)].names,
+			                               sizeof(InternEntry));
+
+			/* out of memory, keep the old array, it is only slower */
+			if (!copy) {
+				free(grown);
+				goto out;
+			}
+			*copy = *e;
+			copy->next = atomic_load_explicit(&grown->buckets[nb], memory_order_relaxed);
+			atomic_store_explicit(&grown->buckets[nb], copy, memory_order_relaxed);
+		}
+	}
+
+	grown->retired = old;
+	atomic_store_explicit(&table->index, grown, memory_order_release);
+
+out:
+	for (size_t i = INTERN_STRIPES; i-- > 0;)
+		pthread_mutex_unlock(&table->stripes[i].lock);
+}
+
+/* ============================================================
+   ======================= PUBLIC API =========================
+   ============================================================ */
+
+/*
+ * Creates an empty table sized for about expectedSymbols names (0 picks a
+ * small default). The buckets double whenever the names outgrow them, a
+ * good guess only saves the copying.
+ */
+InternTable *internCreate(size_t expectedSymbols)
+{
+	/* the stripes are cache line aligned so the table has to be as well */
+	size_t bytes = (sizeof(InternTable) + 63) & ~(size_t)63;
+	InternTable *table = aligned_alloc(64, bytes);
+	size_t buckets = INTERN_MIN_BUCKETS;
+	unsigned bits = 10;
+
+	if (!table)
+		return NULL;
+	memset(table, 0, bytes);
+
+	while (buckets < expectedSymbols && bits < 30) {
+		buckets <<= 1;
+		bits++;
+	}
+
+	atomic_init(&table->index, newIndex(bits));
+	if (!atomic_load_explicit(&table->index, memory_order_relaxed)) {
+		free(table);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < INTERN_STRIPES; i++) {
+		pthread_mutex_init(&table->stripes[i].lock, NULL);
+		arenaInit(&table->stripes[i].names, 16 * 1024);
+	}
+	for (size_t i = 0; i < INTERN_MAX_CHUNKS; i++)
+		atomic_init(&table->chunks[i], NULL);
+	atomic_init(&table->nextId, 1);
+
+	return table;
+}
+
+/*
+ * Frees the table and every name in it. No lexer may still be using it.
+ */
+void internDestroy(InternTable *table)
+{
+	if (!table)
+		return;
+
+	for (size_t i = 0; i < INTERN_STRIPES; i++) {
+		arenaFree(&table->stripes[i].names);
+		pthread_mutex_destroy(&table->stripes[i].lock);
+	}
+	for (size_t i = 0; i < INTERN_MAX_CHUNKS; i++)
+		free(atomic_load_explicit(&table->chunks[i], memory_order_relaxed));
+
+	for (InternIndex *index = atomic_load_explicit(&table->index, memory_order_relaxed); index;) {
+		InternIndex *retired = index->retired;
+
+		free(index);
+		index = retired;
+	}
+	free(table);
+}
+
+/*
+ * Returns the id of name, adding it if this is the first time it is seen.
+ * hash must be the internHashStep() hash of the name. Returns SYMBOL_NONE
+ * if the name could not be added (out of memory or out of ids).
+ */
+uint32_t internHashed(InternTable *table, const char *name, size_t length, uint32_t hash)
+{
+	InternIndex *index = atomic_load_explicit(&table->index, memory_order_acquire);
+	size_t b = bucketOf(index, hash);
+	InternStripe *stripe;
+	const InternEntry *found;
+	InternEntry *entry;
+	char *copy;
+	size_t id;
+
+	/* fast path, most names have been seen before */
+	found = findIn(atomic_load_explicit(&index->buckets[b], memory_order_acquire), name, length, hash);
+	if (found)
+		return found->id;
+
+	if (length > UINT32_MAX)
+		return SYMBOL_NONE;
+
+	/* the stripe belongs to a bucket of one generation, retry if it grew meanwhile */
+	for (;;) {
+		stripe = &table->stripes[b & (INTERN_STRIPES - 1)];
+		pthread_mutex_lock(&stripe->lock);
+		if (atomic_load_explicit(&table->index, memory_order_relaxed) == index)
+			break;
+		pthread_mutex_unlock(&stripe->lock);
+		index = atomic_load_explicit(&table->index, memory_order_acquire);
+		b = bucketOf(index, hash);
+	}
+
+	/* somebody may have added it between the lookup and the lock */
+	found = findIn(atomic_load_explicit(&index->buckets[b], memory_order_relaxed), name, length, hash);
+	if (found) {
+		pthread_mutex_unlock(&stripe->lock);
+		return found->id;
+	}
+
+	entry = arenaAlloc(&stripe->names, sizeof(InternEntry) + length + 1);
+	id = atomic_fetch_add_explicit(&table->nextId, 1, memory_order_relaxed);
+	if (!entry || id >= INTERN_MAX_SYMBOLS) {
+		pthread_mutex_unlock(&stripe->lock);
+		return SYMBOL_NONE;
+	}
+
+	copy = (char *)(entry + 1);
+	memcpy(copy, name, length);
+	copy[length] = '\0';
+	entry->hash = hash;
+	entry->id = (uint32_t)id;
+	entry->length = (uint32_t)length;
+	entry->name = copy;
+	entry->next = atomic_load_explicit(&index->buckets[b], memory_order_relaxed);
+
+	/* the id has to resolve before anybody can find the entry by name */
+	if (!publishId(table, (uint32_t)id, entry)) {
+		pthread_mutex_unlock(&stripe->lock);
+		return SYMBOL_NONE;
+	}
+	atomic_store_explicit(&index->buckets[b], entry, memory_order_release);
+
+	pthread_mutex_unlock(&stripe->lock);
+
+	if (id > (size_t)2 << (32 - index->shift))
+		growTable(table);
+	return (uint32_t)id;
+}
+
+/*
+ * Same as internHashed() for callers that don't have the hash at hand.
+ */
+uint32_t intern(InternTable *table, const char *name, size_t length)
+{
+	uint32_t hash = INTERN_HASH_SEED;
+
+	for (size_t i = 0; i < length; i++)
+		hash = internHashStep(hash, (unsigned char)name[i]);
+
+	return internHashed(table, name, length, hash);
+}
+
+/*
+ * Returns the '\0' terminated name of id and its length, NULL if the id
+ * was never handed out.
+ */
+const char *internName(const InternTable *table, uint32_t id, size_t *length)
+{
+	InternSlot *chunk;
+	const InternEntry *entry;
+
+	if (id == SYMBOL_NONE || id >= INTERN_MAX_SYMBOLS)
+		return NULL;
+
+	chunk = atomic_load_explicit(&((InternTable *)table)->chunks[id >> INTERN_CHUNK_BITS],
+	                             memory_order_acquire);
+	if (!chunk)
+		return NULL;
+
+	entry = atomic_load_explicit(&chunk[id & (INTERN_CHUNK_SIZE - 1)], memory_order_acquire);
+	if (!entry)
+		return NULL;
+
+	if (length)
+		*length = entry->length;
+	return entry->name;
+}
+
+/*
+ * Number of ids handed out so far.
+ */
+size_t internCount(const InternTable *table)
+{
+	size_t next = atomic_load_explicit(&((InternTable *)table)->nextId, memory_order_relaxed);
+
+	if (next > INTERN_MAX_SYMBOLS)
+		next = INTERN_MAX_SYMBOLS;
+	return next - 1;
+}
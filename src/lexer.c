@@ -9,28 +9,106 @@
 *        are just indexs into the main string. So every toke has a starting
 *        position and and ending position in the character array
 ******************************************************************************/
+/* mmap, madvise and MAP_ANONYMOUS are hidden by -std=c11 without this */
+#define _DEFAULT_SOURCE
+
 #include "lexer.h"
 #include "hash.h"
-#include <ctype.h>
+#include "scan.h"
+#include "numeric.h"
+#include "intern.h"
+#include "arena.h"
+#include "lextables.h"
 #include <string.h>
 #include <math.h>
 #include <stdlib.h>
 
+#if defined(LEXER_STATS_CYCLES) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define STATS_NOW() __rdtsc()
+#else
+#define STATS_NOW() 0
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LEXER_HAVE_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Files smaller than this are read into a malloc buffer, setting up a
+ * mapping costs more than copying a few pages. Mappings up to the populate
+ * limit are prefaulted in one go, bigger ones rely on sequential readahead
+ * so RSS only grows as the lexer walks the file.
+ */
+#define LEXER_MMAP_MIN        (64 * 1024)
+#define LEXER_POPULATE_LIMIT  (64 * 1024 * 1024)
+#define LEXER_HUGEPAGE_MIN    (2 * 1024 * 1024)
+
+/*
+ * lexTable() jumps straight to its states through a table of label
+ * addresses with GCC and clang, anything else gets the switch.
+ */
+#if defined(__GNUC__) && !defined(LEXER_NO_COMPUTED_GOTO)
+#define LEXER_COMPUTED_GOTO 1
+#endif
+
 /* token list defined in header file lexer.h*/
 static const char *tokenTypeNames[TOKEN_COUNT] = {
-    #define X(name) [name] = #name,
+    #define X(name, spelling) [name] = #name,
         TOKEN_LIST
      #undef X
  };
 
- #define isxblurf(c) \
- ((c) == 'x' || (c) == 'X' || \
-  (c) == 'b' || (c) == 'B' || \
-  (c) == 'u' || (c) == 'U' || \
-  (c) == 'l' || (c) == 'L' || \
-  (c) == 'f' || (c) == 'F' || \
-  (c) == '.' || (c) == 'o' || \
-  (c) == 'O' )
+static const char *errorMessages[LEX_ERR_COUNT] = {
+    #define X(name, message) [name] = message,
+        ERROR_LIST
+    #undef X
+};
+
+_Static_assert(TOKEN_COUNT <= 64, "triviaMask needs a bit per token type");
+
+/*
+ * Character classes for every byte value. One lookup replaces the ctype
+ * calls so classification never depends on the current locale. Bytes at
+ * 0x80 and above have no class just like isalpha() and friends in the C
+ * locale.
+ */
+#define CC_SPACE     0x01   /* space \t \n \v \f \r                       */
+#define CC_DIGIT     0x02   /* 0-9                                        */
+#define CC_XDIGIT    0x04   /* 0-9 a-f A-F                                */
+#define CC_IDSTART   0x08   /* a-z A-Z _                                  */
+#define CC_IDENT     0x10   /* a-z A-Z 0-9 _                              */
+#define CC_NUMSUFFIX 0x20   /* x X b B u U l L f F . o O (old isxblurf)   */
+#define CC_OCT       0x40   /* 0-7                                        */
+#define CC_BIN       0x80   /* 0-1                                        */
+
+#define charIs(c, cls) (charClass[(unsigned char)(c)] & (cls))
+
+/* one past the last byte of input, where the scan kernels stop */
+#define inputEnd(lxer) ((lxer)->input + (lxer)->length)
+
+static const uint8_t charClass[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00,  /* 0x00 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /* 0x10 */
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00,  /* 0x20 */
+    0xd6, 0xd6, 0x56, 0x56, 0x56, 0x56, 0x56, 0x56, 0x16, 0x16, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /* 0x30 */
+    0x00, 0x1c, 0x3c, 0x1c, 0x1c, 0x1c, 0x3c, 0x18, 0x18, 0x18, 0x18, 0x18, 0x38, 0x18, 0x18, 0x38,  /* 0x40 */
+    0x18, 0x18, 0x18, 0x18, 0x18, 0x38, 0x18, 0x18, 0x38, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x18,  /* 0x50 */
+    0x00, 0x1c, 0x3c, 0x1c, 0x1c, 0x1c, 0x3c, 0x18, 0x18, 0x18, 0x18, 0x18, 0x38, 0x18, 0x18, 0x38,  /* 0x60 */
+    0x18, 0x18, 0x18, 0x18, 0x18, 0x38, 0x18, 0x18, 0x38, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00,  /* 0x70 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /* 0x80 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /* 0x90 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /* 0xa0 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /* 0xb0 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /* 0xc0 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /* 0xd0 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /* 0xe0 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00   /* 0xf0 */
+};
 
 
 
@@ -54,19 +132,30 @@ typedef enum {
 	STRING_EXIT
 } stringState;
 
+static void advanceSpan(LexerInfo *lxer, ScanSpan span);
+static Token nextFromRing(LexerInfo *lxer);
+#ifdef LEXER_STATS
+static void statsCountError(LexerStats *stats, const char *msg, uint64_t n);
+#endif
+
 /* ============================================================
    ===================== LEXER FUNCTIONS  =====================
    ============================================================ */
 
 /*
- * Frees a lexer structure allocated via lexerCreate.
+ * Lets go of the current input: unmaps a mapped file and frees a string
+ * the lexer was told it owns. The reusable read buffer is kept.
  */
-void lexerDestroy(LexerInfo *lex)
+static void releaseInput(LexerInfo *lex)
 {
-	if (!lex)
-		return;
+#ifdef LEXER_HAVE_MMAP
+	if (lex->mappedSize) {
+		munmap((void *)lex->input, lex->mappedSize);
+		lex->ownsInput = false;
+	}
+#endif
 
-	if (lex->ownsInput == true) {
+	if (lex->ownsInput == true && lex->input != lex->readBuffer) {
 		/*
 		 * this cast is kinda bad i think the lexer struct store the
 		 * input originally as a const char *pointer but when you read
@@ -75,9 +164,107 @@ void lexerDestroy(LexerInfo *lex)
 		 */
 		free((char *)lex->input);
 	}
+
+	lex->ownsInput = false;
+	lex->mappedSize = 0;
+}
+
+/*
+ * Frees everything a lexer holds but not the LexerInfo itself, for lexers
+ * set up with lexerInit().
+ */
+void lexerRelease(LexerInfo *lex)
+{
+	if (!lex)
+		return;
+
+	releaseInput(lex);
+
+	free(lex->readBuffer);
+	free(lex->lineStarts);
+	free(lex->diagnostics);
+	free(lex->ring);
+	lex->readBuffer = NULL;
+	lex->readCapacity = 0;
+	lex->lineStarts = NULL;
+	lex->lineCount = 0;
+	lex->lineCap = 0;
+	lex->diagnostics = NULL;
+	lex->diagnosticCount = 0;
+	lex->diagnosticCap = 0;
+	lex->ring = NULL;
+	lex->ringCap = 0;
+	lex->ringBase = lex->ringNext = lex->ringEnd = 0;
+	lex->markDepth = 0;
+}
+
+/*
+ * Frees a lexer structure allocated via lexerCreate.
+ */
+void lexerDestroy(LexerInfo *lex)
+{
+	if (!lex)
+		return;
+
+	lexerRelease(lex);
 	free(lex);
 }
 
+/*
+ * Sets up a caller provided LexerInfo (on the stack, in an array, ...) to
+ * lex inputString. Release it with lexerRelease() instead of lexerDestroy().
+ */
+void lexerInit(LexerInfo *lex, const char *inputString)
+{
+	lexerInitSpan(lex, inputString, strlen(inputString));
+}
+
+/*
+ * lexerInit() for the length bytes at input, which don't have to be '\0'
+ * terminated, so a slice of a bigger buffer is lexed where it is. See
+ * LEXER_PADDING for what has to be readable after it.
+ */
+void lexerInitSpan(LexerInfo *lex, const char *input, size_t length)
+{
+	lex->input = input;
+	lex->length = length;
+	lex->pos = 0;
+    lex->lines = 1;
+    lex->cols = 0;
+	lex->ownsInput = false;
+	lex->mappedSize = 0;
+	lex->errorFn = NULL;
+	lex->errorUserData = NULL;
+	lex->lazyPositions = false;
+	lex->lineStarts = NULL;
+	lex->lineCount = 0;
+	lex->lineCap = 0;
+	lex->decodeLiterals = false;
+	lex->symbols = NULL;
+	lex->readBuffer = NULL;
+	lex->readCapacity = 0;
+	lex->bufferDiagnostics = false;
+	lex->maxErrors = 0;
+	lex->errorCount = 0;
+	lex->diagnostics = NULL;
+	lex->diagnosticCount = 0;
+	lex->diagnosticCap = 0;
+	lex->triviaMask = 0;
+	lex->leadingTrivia = 0;
+	lex->ring = NULL;
+	lex->ringCap = 0;
+	lex->ringBase = 0;
+	lex->ringNext = 0;
+	lex->ringEnd = 0;
+	lex->markDepth = 0;
+	lex->tableDriven = false;
+	lex->sinkCount = 0;
+	lex->sinkCarried = false;
+#ifdef LEXER_STATS
+	memset(&lex->stats, 0, sizeof(lex->stats));
+#endif
+}
+
 /*
  * Creates a lexer from a given input string.
  * Returns a pointer to a LexerInfo structure.
@@ -89,29 +276,70 @@ LexerInfo *lexerCreate(const char *inputString)
 	if (!lex)
 		return NULL;
 
-	lex->input = inputString;
-	lex->pos = 0;
-    lex->lines = 1;
-    lex->cols = 0;
-	lex->ownsInput = false;
+	lexerInit(lex, inputString);
+	return lex;
+}
+
+/*
+ * lexerCreate() for the length bytes at input, see lexerInitSpan().
+ */
+LexerInfo *lexerCreateFromSpan(const char *input, size_t length)
+{
+	LexerInfo *lex = malloc(sizeof(LexerInfo));
 
+	if (!lex)
+		return NULL;
+
+	lexerInitSpan(lex, input, length);
 	return lex;
 }
 
 /*
- * Creates a lexer from the contents of a file.
- * Reads the entire file into memory, null-terminates it,
- * and returns a LexerInfo pointer.
+ * Points the lexer at a new input and starts over at line 1. The settings
+ * (error callback, lazyPositions, decodeLiterals, symbols, maxErrors,
+ * triviaMask) are kept and so are the read buffer, line index, diagnostics
+ * and lookahead allocations, which is what makes reusing one lexer for many
+ * files cheaper than creating one per file.
  */
-LexerInfo *lexerCreateFromFile(const char *filename)
+void lexerReset(LexerInfo *lex, const char *inputString)
+{
+	lexerResetSpan(lex, inputString, strlen(inputString));
+}
+
+/*
+ * lexerReset() onto the length bytes at input, see lexerInitSpan().
+ */
+void lexerResetSpan(LexerInfo *lex, const char *input, size_t length)
+{
+	/* rewinding onto the same input must not drop it */
+	if (input != lex->input)
+		releaseInput(lex);
+
+	lex->input = input;
+	lex->length = length;
+	lex->pos = 0;
+	lex->lines = 1;
+	lex->cols = 0;
+	lex->lineCount = 0;
+	/* records still pending point into the old input, flush them first */
+	lex->errorCount = 0;
+	lex->diagnosticCount = 0;
+	lex->leadingTrivia = 0;
+	/* lookahead belongs to the old input, marks too */
+	lex->ringBase = lex->ringNext = lex->ringEnd = 0;
+	lex->markDepth = 0;
+	lex->sinkCarried = false;
+}
+
+/*
+ * Reads the whole file into *buffer followed by LEXER_PADDING zero bytes
+ * and stores the bytes read in *length. The buffer is only reallocated when
+ * it is too small.
+ */
+static bool readSourceFile(FILE *file, char **buffer, size_t *capacity, size_t *length)
 {
-	FILE *file = fopen(filename, "r");
-	LexerInfo *lex;
 	long fileSize;
-	char *buffer;
     size_t bytesRead = 0;
-	if (!file)
-		return NULL;
 
 	/* Determine file size */
 	fseek(file, 0, SEEK_END);
@@ -121,119 +349,225 @@ LexerInfo *lexerCreateFromFile(const char *filename)
     
     if (fileSize < 0) {
         /* Error: ftell returns -1 on error */
-        fclose(file);
-        return NULL;
+        return false;
     }
 
-	/* Allocate buffer for file contents + null terminator */
-	buffer = malloc(fileSize + 1);
-	if (!buffer) {
-		fclose(file);
-		return NULL;
+	/* Allocate buffer for file contents + padding, which starts with the null terminator */
+	if (*capacity < (size_t)fileSize + LEXER_PADDING) {
+		/* the old contents are thrown away, no point in realloc copying them */
+		free(*buffer);
+		*capacity = 0;
+		*buffer = malloc((size_t)fileSize + LEXER_PADDING);
+		if (!*buffer)
+			return false;
+		*capacity = (size_t)fileSize + LEXER_PADDING;
 	}
 
     // use bytesRead becuase on windws  text mode 'r' translates \r\n into \n so the bytes 
     // read by fread can be les than what ftell reports
-	bytesRead = fread(buffer, 1, fileSize, file);
-    buffer[bytesRead] = '\0';
-	fclose(file);
+	bytesRead = fread(*buffer, 1, fileSize, file);
+	memset(*buffer + bytesRead, 0, LEXER_PADDING);
+	*length = bytesRead;
+	return true;
+}
+
+#ifdef LEXER_HAVE_MMAP
+/*
+ * Maps a regular file read only. An anonymous region one page longer than
+ * the file is reserved first and the file is mapped over the front of it,
+ * so there is always at least a page of zeros after the last byte. That
+ * covers LEXER_PADDING and the '\0' terminator without copying the file,
+ * even when the file size is an exact multiple of the page size.
+ * Returns NULL when the file should be read the old way instead.
+ */
+static const char *mapSourceFile(int fd, size_t fileSize, size_t *mappedSize)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t total = (fileSize + page - 1) / page * page + page;
+	int flags = MAP_PRIVATE | MAP_FIXED;
+	char *base;
+
+	base = mmap(NULL, total, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+#ifdef MAP_POPULATE
+	if (fileSize <= LEXER_POPULATE_LIMIT)
+		flags |= MAP_POPULATE;
+#endif
+
+	if (mmap(base, fileSize, PROT_READ, flags, fd, 0) == MAP_FAILED) {
+		munmap(base, total);
+		return NULL;
+	}
+
+	/* hints only, failures here are harmless */
+	madvise(base, fileSize, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	if (fileSize >= LEXER_HUGEPAGE_MIN)
+		madvise(base, fileSize, MADV_HUGEPAGE);
+#endif
+
+	*mappedSize = total;
+	return base;
+}
+#endif
 
+/*
+ * Creates a lexer from the contents of a file.
+ * Large regular files are memory mapped, everything else is read into a
+ * null-terminated buffer. Either way the lexer owns the input and
+ * lexerDestroy releases it.
+ */
+LexerInfo *lexerCreateFromFile(const char *filename)
+{
 	/* Use lexerCreate to initialize lexer */
-	lex = lexerCreate(buffer);
+	LexerInfo *lex = lexerCreate("");
 
-	/*
-	 * turn on tracking if the lexer owners the string and then return
-	 * it so you can deallocated buffer later
-	 */
-	if (!lex) {
-		free(buffer);
+	if (!lex)
+		return NULL;
+
+	if (!lexerResetFromFile(lex, filename)) {
+		lexerDestroy(lex);
 		return NULL;
 	}
-	lex->ownsInput = true;
 	return lex;
 }
 
+/*
+ * lexerReset() onto the contents of a file. Big files are mapped, the rest
+ * are read into the lexer's read buffer, which keeps its size across calls
+ * so lexing many small files one after the other stops hitting malloc.
+ * Returns false if the file could not be read, the lexer is then left on
+ * an empty input.
+ */
+bool lexerResetFromFile(LexerInfo *lex, const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	const char *buffer = NULL;
+	size_t mappedSize = 0;
+	size_t length = 0;
+
+	/* drop the old input first, the read buffer is about to be overwritten */
+	lexerReset(lex, "");
+
+	if (!file)
+		return false;
+
+#ifdef LEXER_HAVE_MMAP
+	{
+		struct stat st;
+
+		if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) &&
+		    st.st_size >= LEXER_MMAP_MIN) {
+			buffer = mapSourceFile(fileno(file), (size_t)st.st_size, &mappedSize);
+			length = (size_t)st.st_size;
+		}
+	}
+#endif
+
+	if (!buffer && readSourceFile(file, &lex->readBuffer, &lex->readCapacity, &length))
+		buffer = lex->readBuffer;
+	fclose(file);
+
+	if (!buffer)
+		return false;
+
+	/*
+	 * turn on tracking if the lexer owners the string so
+	 * it gets released with the lexer
+	 */
+	lex->input = buffer;
+	lex->length = length;
+	lex->ownsInput = true;
+	lex->mappedSize = mappedSize;
+	return true;
+}
+
 /* ============================================================
    +====================  TOKEN DRIVERS  ======================
    ============================================================ */
 
 /*
- * Returns the next token from the input.
- * Dispatches \n to appropriate handlers based on character type.
+ * A // comment, the newline ending it is part of the token.
  */
-Token nextToken(LexerInfo *lxer)
+static Token lineComment(LexerInfo *lxer)
 {
-    
 	Token tok = {0};
-	char c = peek(lxer);
 
-    // this comment support is wonky and needs to be changed later. throw it into a function or something
+	tok.start = lxer->input + lxer->pos;
+	tok.type = TOKEN_COMMENT;
 
-    if (c == '/' && peekNext(lxer) == '/' )
-    {
-        tok.start = lxer->input + lxer->pos;
-        tok.type = TOKEN_COMMENT;
-        //commnet state
-        advance(lxer);
-        advance(lxer);
-        tok.length++;
-        tok.length++;
+	/* jump straight to the end of the line, the newline is part of the comment */
+	ScanSpan span = scanLine(tok.start + 2, inputEnd(lxer));
+	span.length += 2;
+	advanceSpan(lxer, span);
+	tok.length = span.length;
 
-        while (!peekEoF(lxer)) {
-            /* code */
-            //advance(lxer);
-            if (peek(lxer) == '\n') {
+	if (peek(lxer) == '\n') {
+		advance(lxer);
+		tok.length++;
+	}
 
-                advance(lxer);
-                tok.length++;
+	return tok;
+}
 
-                return tok;
-            }
-            tok.length++;
-            advance(lxer);
-        }
+/*
+ * A block comment. Running into the end of the input is an error.
+ */
+static Token blockComment(LexerInfo *lxer)
+{
+	Token tok = {0};
 
-        return tok;
-    }
+	tok.start = lxer->input + lxer->pos;
+	tok.type = TOKEN_COMMENT;
+
+	/* the body is measured in one go and the line count bumped in bulk */
+	ScanSpan span = scanBlockComment(tok.start + 2, inputEnd(lxer));
+	if (span.newlines)
+		span.lastNewline += 2;
+	span.length += 2;
+	advanceSpan(lxer, span);
+	tok.length = span.length;
+
+	if (!peekEoF(lxer)) {
+		advance(lxer);
+		advance(lxer);
+		tok.length += 2;
+		return tok;
+	}
+	// restart tokenization? I dunno if this is good or not i probably need to fix this nonsense typing issue here
+	reportLexerError(lxer, LEX_ERR_UNTERMINATED_COMMENT);
+	tok.type = TOKEN_ERR;
+	return tok;
+}
+
+/*
+ * Returns the next token from the input.
+ * Dispatches \n to appropriate handlers based on character type.
+ */
+static Token lexToken(LexerInfo *lxer)
+{
     
+	Token tok = {0};
+	char c = peek(lxer);
 
-    /* Handle comments */
-    if(c == '/' && peekNext(lxer) == '*' ){
-        tok.start = lxer->input + lxer->pos;
-        tok.type = TOKEN_COMMENT;
-        //commnet state
-        advance(lxer);
-        advance(lxer);
-        tok.length++;
-        tok.length++;
-
-        while (!peekEoF(lxer)) {
-            if (peek(lxer) == '*' && peekNext(lxer) == '/') {
-                advance(lxer);
-                advance(lxer);
-                tok.length++;
-                tok.length++;
-                return tok;
-            }
-            tok.length++;
-            advance(lxer);
-        }
-        // restart tokenization? I dunno if this is good or not i probably need to fix this nonsense typing issue here
-        reportLexerError(lxer, "Unterminated comment");
-        tok.type = TOKEN_ERR;
-        return tok;
-    }
+	/* Handle comments */
+	if (c == '/' && peekNext(lxer) == '/')
+		return lineComment(lxer);
+	if (c == '/' && peekNext(lxer) == '*')
+		return blockComment(lxer);
 
 	/* Whitespace or delimiter */
-	if (isspace(c))
+	if (charIs(c, CC_SPACE))
 		return delimHandler(lxer);
 
 	/* Numeric literal (int or float) */
-	if (isdigit(c) || (c == '.' && isdigit(peekNext(lxer))))
+	if (charIs(c, CC_DIGIT) || (c == '.' && charIs(peekNext(lxer), CC_DIGIT)))
 		return numHandler(lxer);
 
 	/* Identifier or keyword */
-	if (isalpha(c) || c == '_')
+	if (charIs(c, CC_IDSTART))
 		return identHandler(lxer);
 
 	/* Single-character or multi-character tokens */
@@ -241,9 +575,15 @@ Token nextToken(LexerInfo *lxer)
         
 	case '\0':
 		tok.start = lxer->input + lxer->pos;
-		tok.type = TOKEN_EOF;
 		tok.length = 1;
-		advance(lxer);
+		/* a NUL short of length is a stray byte, not the end */
+		if (!peekEoF(lxer)) {
+			tok.type = TOKEN_ERR;
+			advance(lxer);
+			reportLexerError(lxer, LEX_ERR_EMBEDDED_NUL);
+			return tok;
+		}
+		tok.type = TOKEN_EOF;
 		return tok;
 
 	case '(':
@@ -260,104 +600,880 @@ Token nextToken(LexerInfo *lxer)
 		advance(lxer);
 		return tok;
 
-	case '{':
-		tok.start = lxer->input + lxer->pos;
-		tok.type = TOKEN_LBRACE;
-		tok.length = 1;
-		advance(lxer);
-		return tok;
+	case '{':
+		tok.start = lxer->input + lxer->pos;
+		tok.type = TOKEN_LBRACE;
+		tok.length = 1;
+		advance(lxer);
+		return tok;
+
+	case '}':
+		tok.start = lxer->input + lxer->pos;
+		tok.type = TOKEN_RBRACE;
+		tok.length = 1;
+		advance(lxer);
+		return tok;
+
+    case '[':
+		tok.start = lxer->input + lxer->pos;
+		tok.type = TOKEN_LBRAK;
+		tok.length = 1;
+		advance(lxer);
+		return tok;
+
+	case ']':
+		tok.start = lxer->input + lxer->pos;
+		tok.type = TOKEN_RBRAk;
+		tok.length = 1;
+		advance(lxer);
+		return tok;
+
+	case ';':
+		tok.start = lxer->input + lxer->pos;
+		tok.type = TOKEN_SEMICOL;
+		tok.length = 1;
+		advance(lxer);
+		return tok;
+
+    case ',':
+		tok.start = lxer->input + lxer->pos;
+		tok.type = TOKEN_SEPERATOR;
+		tok.length = 1;
+		advance(lxer);
+		return tok;    
+
+	case '+':
+		return opHandler(lxer);
+    
+    case '%':
+		return opHandler(lxer);
+
+    case '-':
+		return opHandler(lxer);
+
+    case '!':
+		return opHandler(lxer);
+    
+    case ':':
+		return opHandler(lxer);       
+
+    case '~':
+		return opHandler(lxer); 
+
+    case '&':
+		return opHandler(lxer); 
+
+    case '@':
+		return opHandler(lxer);
+
+    case '|':
+		return opHandler(lxer);  
+        
+	case '=':
+		return opHandler(lxer);
+
+	case '*':
+		return opHandler(lxer);
+
+	case '/':
+		return opHandler(lxer);
+
+	case '<':
+		return opHandler(lxer);
+
+	case '>':
+		return opHandler(lxer);
+
+	case '"':
+		return stringHandler(lxer);
+
+    case '\'':
+		return charHandler(lxer);        
+        
+	default:
+		tok.start = lxer->input + lxer->pos;
+		tok.type = TOKEN_ERR;
+		tok.length = 1;
+		advance(lxer);
+		reportLexerError(lxer, LEX_ERR_OUT_OF_PLACE);
+		return tok;
+	}
+}
+
+#ifdef LEXER_STATS
+/*
+ * The branch lexToken() will take for a token starting with c, next. Has
+ * to mirror the order of the tests in lexToken().
+ */
+static LexerBranch statsBranch(char c, char next)
+{
+	if (c == '/' && next == '/')
+		return LEXER_BRANCH_LINE_COMMENT;
+	if (c == '/' && next == '*')
+		return LEXER_BRANCH_BLOCK_COMMENT;
+	if (charIs(c, CC_SPACE))
+		return LEXER_BRANCH_DELIM;
+	if (charIs(c, CC_DIGIT) || (c == '.' && charIs(next, CC_DIGIT)))
+		return LEXER_BRANCH_NUMBER;
+	if (charIs(c, CC_IDSTART))
+		return LEXER_BRANCH_IDENT;
+
+	switch (c) {
+	case '\0':
+		return LEXER_BRANCH_EOF;
+	case '(': case ')': case '{': case '}': case '[': case ']': case ';': case ',':
+		return LEXER_BRANCH_PUNCT;
+	case '+': case '%': case '-': case '!': case ':': case '~': case '&': case '@':
+	case '|': case '=': case '*': case '/': case '<': case '>':
+		return LEXER_BRANCH_OPERATOR;
+	case '"':
+		return LEXER_BRANCH_STRING;
+	case '\'':
+		return LEXER_BRANCH_CHAR;
+	default:
+		return LEXER_BRANCH_UNKNOWN;
+	}
+}
+#endif
+
+/*
+ * The generated engine, picked with LexerInfo.tableDriven. The class of the
+ * first byte selects the state, operators and punctuation are settled by
+ * one lexOpPair lookup on the first two bytes where lexToken() goes through
+ * its switch and then the one in opHandler(). Tokens, errors and positions
+ * are the same as lexToken()'s, the literal states share its handlers.
+ */
+#ifdef LEXER_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+static Token lexTable(LexerInfo *lxer)
+{
+	const char *p = lxer->input + lxer->pos;
+	unsigned char c = (unsigned char)peek(lxer);
+	unsigned char next;
+	uint8_t op;
+	Token tok = {0};
+
+#ifdef LEXER_COMPUTED_GOTO
+	static const void *const states[LEX_CLASS_COUNT] = {
+		[LEX_CLASS_ERR]    = &&err,
+		[LEX_CLASS_EOF]    = &&eof,
+		[LEX_CLASS_SPACE]  = &&space,
+		[LEX_CLASS_DIGIT]  = &&digit,
+		[LEX_CLASS_DOT]    = &&dot,
+		[LEX_CLASS_IDENT]  = &&ident,
+		[LEX_CLASS_SLASH]  = &&slash,
+		[LEX_CLASS_OP]     = &&oper,
+		[LEX_CLASS_STRING] = &&string,
+		[LEX_CLASS_CHAR]   = &&chr,
+	};
+
+	goto *states[lexClass[c]];
+#else
+	switch (lexClass[c]) {
+	case LEX_CLASS_EOF:    goto eof;
+	case LEX_CLASS_SPACE:  goto space;
+	case LEX_CLASS_DIGIT:  goto digit;
+	case LEX_CLASS_DOT:    goto dot;
+	case LEX_CLASS_IDENT:  goto ident;
+	case LEX_CLASS_SLASH:  goto slash;
+	case LEX_CLASS_OP:     goto oper;
+	case LEX_CLASS_STRING: goto string;
+	case LEX_CLASS_CHAR:   goto chr;
+	default:               goto err;
+	}
+#endif
+
+space:
+	return delimHandler(lxer);
+digit:
+	return numHandler(lxer);
+ident:
+	return identHandler(lxer);
+string:
+	return stringHandler(lxer);
+chr:
+	return charHandler(lxer);
+
+dot:
+	if (charIs(peekNext(lxer), CC_DIGIT))
+		return numHandler(lxer);
+	goto err;
+
+slash:
+	next = (unsigned char)peekNext(lxer);
+	if (next == '/')
+		return lineComment(lxer);
+	if (next == '*')
+		return blockComment(lxer);
+	goto pair;
+
+oper:
+	next = (unsigned char)peekNext(lxer);
+pair:
+	op = lexOpPair[lexOpIndex[c]][lexOpIndex[next]];
+	tok.start = p;
+	tok.type = op & ~LEX_OP_LONG;
+	tok.length = op & LEX_OP_LONG ? 2 : 1;
+	/* operators never hold a newline, only the column moves */
+	lxer->pos += tok.length;
+	if (!lxer->lazyPositions)
+		lxer->cols += tok.length;
+	return tok;
+
+eof:
+	tok.start = p;
+	tok.length = 1;
+	if (!peekEoF(lxer)) {
+		tok.type = TOKEN_ERR;
+		advance(lxer);
+		reportLexerError(lxer, LEX_ERR_EMBEDDED_NUL);
+		return tok;
+	}
+	tok.type = TOKEN_EOF;
+	return tok;
+
+err:
+	tok.start = p;
+	tok.type = TOKEN_ERR;
+	tok.length = 1;
+	advance(lxer);
+	reportLexerError(lxer, LEX_ERR_OUT_OF_PLACE);
+	return tok;
+}
+#ifdef LEXER_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+/* Lexes one token with whichever engine tableDriven selects. */
+static inline Token lexEngine(LexerInfo *lxer)
+{
+	return lxer->tableDriven ? lexTable(lxer) : lexToken(lxer);
+}
+
+/*
+ * Lexes one token and, once the lexer is over maxErrors, turns a token that
+ * raised another error into one TOKEN_ERR running to the end of the line.
+ * Garbage input then costs a line scan per line instead of a handler call
+ * and an error report per byte. Only used when maxErrors is set.
+ */
+static Token lexRecovering(LexerInfo *lxer)
+{
+	size_t errors = lxer->errorCount;
+	Token tok = lexEngine(lxer);
+
+	if (lxer->errorCount == errors ||
+	    lxer->errorCount <= lxer->maxErrors || tok.type == TOKEN_EOF)
+		return tok;
+
+	advanceSpan(lxer, scanLine(lxer->input + lxer->pos, inputEnd(lxer)));
+	tok.type = TOKEN_ERR;
+	tok.length = (size_t)(lxer->input + lxer->pos - tok.start);
+	return tok;
+}
+
+/*
+ * Lexes one token, trivia or not. With LEXER_STATS it is counted against
+ * the branch that produced it.
+ */
+static inline Token lexOne(LexerInfo *lxer)
+{
+#ifdef LEXER_STATS
+	LexerBranch branch = statsBranch(peek(lxer), peekNext(lxer));
+	size_t start = lxer->pos;
+	uint64_t ticks = STATS_NOW();
+	Token tok = lxer->maxErrors ? lexRecovering(lxer) : lexEngine(lxer);
+
+	lxer->stats.branchCycles[branch] += STATS_NOW() - ticks;
+	lxer->stats.branchTokens[branch]++;
+	lxer->stats.branchBytes[branch] += lxer->pos - start;
+	return tok;
+#else
+	return lxer->maxErrors ? lexRecovering(lxer) : lexEngine(lxer);
+#endif
+}
+
+/*
+ * Lexes the next token that is not trivia. Token types in triviaMask are
+ * consumed here instead of being returned, whitespace runs without ever
+ * building a token when every delimiter type is masked. leadingTrivia is
+ * left at the number of bytes skipped in front of the returned token.
+ */
+static Token lexSignificant(LexerInfo *lxer)
+{
+	size_t start = lxer->pos;
+	Token tok;
+
+	if (!lxer->triviaMask) {
+		tok = lexOne(lxer);
+	} else {
+		bool skipSpace = (lxer->triviaMask & LEXER_TRIVIA_WHITESPACE) == LEXER_TRIVIA_WHITESPACE;
+
+		for (;;) {
+			if (skipSpace && charIs(peek(lxer), CC_SPACE)) {
+				ScanSpan span = scanWhitespace(lxer->input + lxer->pos, inputEnd(lxer));
+
+				advanceSpan(lxer, span);
+#ifdef LEXER_STATS
+				lxer->stats.branchTokens[LEXER_BRANCH_DELIM]++;
+				lxer->stats.branchBytes[LEXER_BRANCH_DELIM] += span.length;
+#endif
+			}
+
+			tok = lexOne(lxer);
+			if (tok.type == TOKEN_EOF || !(lxer->triviaMask & LEXER_TRIVIA(tok.type)))
+				break;
+		}
+	}
+
+	lxer->leadingTrivia = (size_t)(tok.start - lxer->input) - start;
+#ifdef LEXER_STATS
+	lxer->stats.tokens[tok.type]++;
+#endif
+	return tok;
+}
+
+/*
+ * Returns the next token from the input, from the lookahead ring when
+ * peekToken() already lexed it. A caller using none of lookahead, trivia
+ * masking and error recovery goes straight to the engine, the layers
+ * above it cost about a third of the time per token.
+ */
+Token nextToken(LexerInfo *lxer)
+{
+	if (lxer->ringNext == lxer->ringEnd && !lxer->markDepth) {
+#ifndef LEXER_STATS
+		if (!lxer->triviaMask && !lxer->maxErrors) {
+			lxer->leadingTrivia = 0;
+			return lexEngine(lxer);
+		}
+#endif
+		return lexSignificant(lxer);
+	}
+	return nextFromRing(lxer);
+}
+
+/* ============================================================
+   ======================== LOOKAHEAD =========================
+   ============================================================ */
+
+#define RING_MIN_SLOTS 16
+
+/*
+ * Makes room for one more token, doubling the ring when the tokens it has
+ * to keep fill it. A token always sits at its number modulo the size.
+ */
+static bool growRing(LexerInfo *lxer)
+{
+	size_t cap = lxer->ringCap ? lxer->ringCap * 2 : RING_MIN_SLOTS;
+	LookaheadSlot *ring;
+
+	if (lxer->ringEnd - lxer->ringBase < lxer->ringCap)
+		return true;
+
+	ring = malloc(cap * sizeof(*ring));
+	if (!ring)
+		return false;
+	for (size_t n = lxer->ringBase; n < lxer->ringEnd; n++)
+		ring[n & (cap - 1)] = lxer->ring[n & (lxer->ringCap - 1)];
+
+	free(lxer->ring);
+	lxer->ring = ring;
+	lxer->ringCap = cap;
+	return true;
+}
+
+/*
+ * Lexes one more token into the ring. The lexer runs from where the last
+ * lexed token ended and is put back afterwards, so pos/lines/cols keep
+ * describing what nextToken() has handed out so far.
+ */
+static bool lexAhead(LexerInfo *lxer)
+{
+	size_t pos = lxer->pos, lines = lxer->lines, cols = lxer->cols;
+	size_t trivia = lxer->leadingTrivia;
+	LookaheadSlot *slot;
+
+	if (!growRing(lxer))
+		return false;
+
+	if (lxer->ringEnd != lxer->ringNext) {
+		const LookaheadSlot *last = &lxer->ring[(lxer->ringEnd - 1) & (lxer->ringCap - 1)];
+
+		lxer->pos = last->pos;
+		lxer->lines = last->lines;
+		lxer->cols = last->cols;
+	}
+
+	slot = &lxer->ring[lxer->ringEnd & (lxer->ringCap - 1)];
+	slot->tok = lexSignificant(lxer);
+	slot->pos = lxer->pos;
+	slot->lines = lxer->lines;
+	slot->cols = lxer->cols;
+	lxer->ringEnd++;
+
+	lxer->pos = pos;
+	lxer->lines = lines;
+	lxer->cols = cols;
+	lxer->leadingTrivia = trivia;
+	return true;
+}
+
+/*
+ * Hands out the next token of the ring, lexing it into the ring first when
+ * a mark has to keep it.
+ */
+static Token nextFromRing(LexerInfo *lxer)
+{
+	const LookaheadSlot *slot;
+	size_t from = lxer->pos;
+
+	/* out of memory, the token can't be kept for a rewind but is still right */
+	if (lxer->ringNext == lxer->ringEnd && !lexAhead(lxer))
+		return lexSignificant(lxer);
+
+	slot = &lxer->ring[lxer->ringNext & (lxer->ringCap - 1)];
+	lxer->ringNext++;
+	if (!lxer->markDepth)
+		lxer->ringBase = lxer->ringNext;
+
+	lxer->pos = slot->pos;
+	lxer->lines = slot->lines;
+	lxer->cols = slot->cols;
+	lxer->leadingTrivia = (size_t)(slot->tok.start - lxer->input) - from;
+	return slot->tok;
+}
+
+/*
+ * Returns the token k places ahead without consuming it, k = 0 is the one
+ * nextToken() returns next. However often a token is peeked at it is only
+ * lexed once. Returns a TOKEN_ERR without text if the ring can't grow.
+ * Errors are reported when a token is lexed, not when it is handed out.
+ * lexerTokenizeParallel and lexerRelex know nothing of the ring, consume
+ * what was peeked before using them.
+ */
+Token peekToken(LexerInfo *lxer, size_t k)
+{
+	Token none = {0};
+
+	while (lxer->ringEnd - lxer->ringNext <= k) {
+		if (!lexAhead(lxer)) {
+			none.type = TOKEN_ERR;
+			return none;
+		}
+	}
+	return lxer->ring[(lxer->ringNext + k) & (lxer->ringCap - 1)].tok;
+}
+
+/*
+ * Starts a speculative parse. Every token nextToken() hands out from here
+ * on is kept so lexerRewind() can hand it out again without lexing it
+ * twice. Marks nest and have to be rewound or dropped last first.
+ */
+LexerMark lexerMark(LexerInfo *lxer)
+{
+	LexerMark mark;
+
+	mark.token = lxer->ringNext;
+	mark.pos = lxer->pos;
+	mark.lines = lxer->lines;
+	mark.cols = lxer->cols;
+	lxer->markDepth++;
+	return mark;
+}
+
+/*
+ * Goes back to mark, nextToken() continues with the token that followed
+ * it. The mark is dropped.
+ */
+void lexerRewind(LexerInfo *lxer, LexerMark mark)
+{
+	lxer->ringNext = mark.token;
+	lxer->pos = mark.pos;
+	lxer->lines = mark.lines;
+	lxer->cols = mark.cols;
+	lexerDropMark(lxer, mark);
+}
+
+/*
+ * Commits to everything since mark. Once no mark is left the tokens
+ * already handed out are let go of.
+ */
+void lexerDropMark(LexerInfo *lxer, LexerMark mark)
+{
+	(void)mark;
+
+	if (lxer->markDepth && --lxer->markDepth == 0)
+		lxer->ringBase = lxer->ringNext;
+}
+
+/* ============================================================
+   ===================== TOKEN BATCHING =======================
+   ============================================================ */
+
+/*
+ * Sets up an empty token buffer with room for capacity tokens.
+ */
+bool tokenBufferInit(TokenBuffer *buf, size_t capacity)
+{
+	buf->types = NULL;
+	buf->offsets = NULL;
+	buf->lengths = NULL;
+	buf->symbols = NULL;
+	buf->arena = NULL;
+	buf->mapping = NULL;
+	buf->mappingSize = 0;
+	buf->count = 0;
+	buf->capacity = 0;
+
+	return tokenBufferReserve(buf, capacity);
+}
+
+/*
+ * Same as tokenBufferInit but the columns come from arena. Such a buffer
+ * needs no tokenBufferFree, resetting or freeing the arena releases it.
+ */
+bool tokenBufferInitArena(TokenBuffer *buf, struct Arena *arena, size_t capacity)
+{
+	tokenBufferInit(buf, 0);
+	buf->arena = arena;
+
+	return tokenBufferReserve(buf, capacity);
+}
+
+/*
+ * realloc for one column, from the arena when the buffer has one.
+ */
+static void *growColumn(TokenBuffer *buf, void *column, size_t width, size_t capacity)
+{
+	if (buf->arena)
+		return arenaGrow(buf->arena, column, buf->capacity * width, capacity * width);
+	return realloc(column, capacity * width);
+}
+
+/*
+ * Moves the columns of a buffer loaded from the token cache out of the
+ * read only mapping into malloc'd ones with room for capacity tokens.
+ */
+static bool copyOutMapping(TokenBuffer *buf, size_t capacity)
+{
+	uint8_t *types = malloc(capacity * sizeof(*types));
+	uint32_t *offsets = malloc(capacity * sizeof(*offsets));
+	uint32_t *lengths = malloc(capacity * sizeof(*lengths));
+
+	if (!types || !offsets || !lengths) {
+		free(types);
+		free(offsets);
+		free(lengths);
+		return false;
+	}
+
+	if (buf->symbols) {
+		uint32_t *symbols = realloc(buf->symbols, capacity * sizeof(*symbols));
+
+		if (!symbols) {
+			free(types);
+			free(offsets);
+			free(lengths);
+			return false;
+		}
+		buf->symbols = symbols;
+	}
+
+	memcpy(types, buf->types, buf->count * sizeof(*types));
+	memcpy(offsets, buf->offsets, buf->count * sizeof(*offsets));
+	memcpy(lengths, buf->lengths, buf->count * sizeof(*lengths));
+#ifdef LEXER_HAVE_MMAP
+	munmap(buf->mapping, buf->mappingSize);
+#endif
+
+	buf->types = types;
+	buf->offsets = offsets;
+	buf->lengths = lengths;
+	buf->mapping = NULL;
+	buf->mappingSize = 0;
+	buf->capacity = capacity;
+	return true;
+}
+
+/*
+ * Grows every column so the buffer can hold at least capacity tokens.
+ * Existing tokens are kept. Returns false if an allocation fails, in which
+ * case the buffer is left as it was.
+ */
+bool tokenBufferReserve(TokenBuffer *buf, size_t capacity)
+{
+	uint8_t *types;
+	uint32_t *offsets;
+	uint32_t *lengths;
+
+	if (capacity <= buf->capacity)
+		return true;
+	if (buf->mapping)
+		return copyOutMapping(buf, capacity);
+
+	types = growColumn(buf, buf->types, sizeof(*types), capacity);
+	if (!types)
+		return false;
+	buf->types = types;
+
+	offsets = growColumn(buf, buf->offsets, sizeof(*offsets), capacity);
+	if (!offsets)
+		return false;
+	buf->offsets = offsets;
+
+	lengths = growColumn(buf, buf->lengths, sizeof(*lengths), capacity);
+	if (!lengths)
+		return false;
+	buf->lengths = lengths;
+
+	if (buf->symbols) {
+		uint32_t *symbols = growColumn(buf, buf->symbols, sizeof(*symbols), capacity);
+
+		if (!symbols)
+			return false;
+		buf->symbols = symbols;
+	}
+
+	buf->capacity = capacity;
+	return true;
+}
+
+/*
+ * Adds the symbols column to a buffer that doesn't have one yet. Tokens
+ * already in the buffer get SYMBOL_NONE. Returns false if out of memory.
+ */
+bool tokenBufferTrackSymbols(TokenBuffer *buf)
+{
+	size_t capacity = buf->capacity ? buf->capacity : 1;
+
+	if (buf->symbols)
+		return true;
+
+	if (buf->arena) {
+		buf->symbols = arenaAlloc(buf->arena, capacity * sizeof(*buf->symbols));
+		if (buf->symbols)
+			memset(buf->symbols, 0, capacity * sizeof(*buf->symbols));
+	} else {
+		buf->symbols = calloc(capacity, sizeof(*buf->symbols));
+	}
+	return buf->symbols != NULL;
+}
+
+/*
+ * Releases the columns of a token buffer. The struct itself is caller owned.
+ */
+void tokenBufferFree(TokenBuffer *buf)
+{
+	if (!buf)
+		return;
+
+	/* arena columns go away with the arena */
+	if (buf->mapping) {
+#ifdef LEXER_HAVE_MMAP
+		munmap(buf->mapping, buf->mappingSize);
+#endif
+		free(buf->symbols);
+	} else if (!buf->arena) {
+		free(buf->types);
+		free(buf->offsets);
+		free(buf->lengths);
+		free(buf->symbols);
+	}
+	buf->mapping = NULL;
+	buf->mappingSize = 0;
+	buf->types = NULL;
+	buf->offsets = NULL;
+	buf->lengths = NULL;
+	buf->symbols = NULL;
+	buf->count = 0;
+	buf->capacity = 0;
+}
+
+/*
+ * Lexes up to maxTokens tokens and appends them to buf, growing the columns
+ * when they run out of room. Stops early once the EOF token has been
+ * written so callers can loop until the last type is TOKEN_EOF.
+ * Returns the number of tokens appended, 0 for an input too big for the
+ * 32 bit offsets.
+ */
+size_t lexerTokenizeBatch(LexerInfo *lxer, TokenBuffer *buf, size_t maxTokens)
+{
+	size_t written = 0;
+
+	if (lxer->length > UINT32_MAX)
+		return 0;
+	if (lxer->symbols && !tokenBufferTrackSymbols(buf))
+		return 0;
 
-	case '}':
-		tok.start = lxer->input + lxer->pos;
-		tok.type = TOKEN_RBRACE;
-		tok.length = 1;
-		advance(lxer);
-		return tok;
+	while (written < maxTokens) {
+		Token tok;
+		size_t i = buf->count;
 
-    case '[':
-		tok.start = lxer->input + lxer->pos;
-		tok.type = TOKEN_LBRAK;
-		tok.length = 1;
-		advance(lxer);
-		return tok;
+		if (i == buf->capacity) {
+			size_t grow = buf->capacity ? buf->capacity * 2 : 256;
 
-	case ']':
-		tok.start = lxer->input + lxer->pos;
-		tok.type = TOKEN_RBRAk;
-		tok.length = 1;
-		advance(lxer);
-		return tok;
+			if (!tokenBufferReserve(buf, grow))
+				break;
+		}
 
-	case ';':
-		tok.start = lxer->input + lxer->pos;
-		tok.type = TOKEN_SEMICOL;
-		tok.length = 1;
-		advance(lxer);
-		return tok;
+		tok = nextToken(lxer);
+		buf->types[i] = (uint8_t)tok.type;
+		buf->offsets[i] = (uint32_t)(tok.start - lxer->input);
+		buf->lengths[i] = (uint32_t)tok.length;
+		if (buf->symbols)
+			buf->symbols[i] = tok.type == TOKEN_IDEN_GENERIC ? tok.value.symbol : SYMBOL_NONE;
+		buf->count++;
+		written++;
+
+		if (tok.type == TOKEN_EOF)
+			break;
+	}
 
-    case ',':
-		tok.start = lxer->input + lxer->pos;
-		tok.type = TOKEN_SEPERATOR;
-		tok.length = 1;
-		advance(lxer);
-		return tok;    
+	return written;
+}
 
-	case '+':
-		return opHandler(lxer);
-    
-    case '%':
-		return opHandler(lxer);
+/*
+ * Lexes the rest of the input into buf, EOF token included.
+ * Returns the number of tokens appended, 0 when the input is over 4GB and
+ * nothing was lexed.
+ */
+size_t lexerTokenizeAll(LexerInfo *lxer, TokenBuffer *buf)
+{
+	size_t total = 0;
 
-    case '-':
-		return opHandler(lxer);
+	if (lxer->length > UINT32_MAX)
+		return 0;
 
-    case '!':
-		return opHandler(lxer);
-    
-    case ':':
-		return opHandler(lxer);       
+	/* a rough first guess of one token every four bytes saves a few regrows */
+	if (buf->capacity == buf->count) {
+		size_t guess = (lxer->length - lxer->pos) / 4 + 16;
 
-    case '~':
-		return opHandler(lxer); 
+		tokenBufferReserve(buf, buf->count + guess);
+	}
 
-    case '&':
-		return opHandler(lxer); 
+	for (;;) {
+		size_t n = lexerTokenizeBatch(lxer, buf, SIZE_MAX);
 
-    case '@':
-		return opHandler(lxer);
+		total += n;
+		if (n == 0 || buf->types[buf->count - 1] == TOKEN_EOF)
+			break;
+	}
 
-    case '|':
-		return opHandler(lxer);  
-        
-	case '=':
-		return opHandler(lxer);
+	return total;
+}
 
-	case '*':
-		return opHandler(lxer);
+/* ============================================================
+   ====================== TOKEN SINKS =========================
+   ============================================================ */
 
-	case '/':
-		return opHandler(lxer);
+/*
+ * Registers fn to be handed every batch lexerDrive() lexes, after the
+ * sinks added before it. Returns false when all LEXER_MAX_SINKS are taken.
+ */
+bool lexerAddSink(LexerInfo *lxer, LexerSinkFn fn, void *userData)
+{
+	if (!fn || lxer->sinkCount == LEXER_MAX_SINKS)
+		return false;
 
-	case '<':
-		return opHandler(lxer);
+	lxer->sinks[lxer->sinkCount].fn = fn;
+	lxer->sinks[lxer->sinkCount].userData = userData;
+	lxer->sinkCount++;
+	return true;
+}
 
-	case '>':
-		return opHandler(lxer);
+void lexerClearSinks(LexerInfo *lxer)
+{
+	lxer->sinkCount = 0;
+}
 
-	case '"':
-		return stringHandler(lxer);
+/*
+ * Hands count tokens to every sink. Returns false when one of them asked
+ * to stop.
+ */
+static bool feedSinks(LexerInfo *lxer, const Token *tokens, size_t count)
+{
+	bool more = true;
 
-    case '\'':
-		return charHandler(lxer);        
-        
-	default:
-		tok.start = lxer->input + lxer->pos;
-		tok.type = TOKEN_ERR;
-		tok.length = 1;
-		advance(lxer);
-		reportLexerError(lxer, "Out of place character");
-		return tok;
+	for (size_t i = 0; count && i < lxer->sinkCount; i++) {
+		if (!lxer->sinks[i].fn(tokens, count, lxer->sinks[i].userData))
+			more = false;
+	}
+	return more;
+}
+
+/*
+ * Lexes up to LEXER_SINK_BATCH tokens into a batch on the stack and hands
+ * it to every sink, so each pass sees the tokens while they are still in
+ * cache. Errors are held back while the batch is lexed and handed to
+ * errorFn right before their token reaches the sinks, which cuts the batch
+ * in two there, so the order is the same as a nextToken() loop. With
+ * bufferDiagnostics set they are left buffered instead. Stores the number
+ * of tokens handed over in delivered when it isn't NULL. Returns false once
+ * the EOF token went out or a sink asked to stop.
+ */
+bool lexerDrive(LexerInfo *lxer, size_t *delivered)
+{
+	Token batch[LEXER_SINK_BATCH];
+	bool buffered = lxer->bufferDiagnostics;
+	size_t count = 0;
+	size_t from = 0;
+	bool more = true;
+
+	/* a token a sink stopped in front of last time, its errors still wait */
+	if (lxer->sinkCarried) {
+		if (!buffered)
+			lexerFlushDiagnostics(lxer);
+		batch[count++] = lxer->sinkCarry;
+		lxer->sinkCarried = false;
+		more = batch[0].type != TOKEN_EOF;
+	}
+
+	lxer->bufferDiagnostics = true;
+	while (more && count < LEXER_SINK_BATCH) {
+		size_t raised = lxer->diagnosticCount;
+		Token tok = nextToken(lxer);
+
+		if (!buffered && lxer->diagnosticCount != raised) {
+			if (!feedSinks(lxer, batch + from, count - from)) {
+				lxer->sinkCarry = tok;
+				lxer->sinkCarried = true;
+				lxer->bufferDiagnostics = buffered;
+				if (delivered)
+					*delivered = count;
+				return false;
+			}
+			lexerFlushDiagnostics(lxer);
+			from = count;
+		}
+
+		batch[count++] = tok;
+		if (tok.type == TOKEN_EOF)
+			more = false;
 	}
+	lxer->bufferDiagnostics = buffered;
+
+	if (!feedSinks(lxer, batch + from, count - from))
+		more = false;
+
+	if (delivered)
+		*delivered = count;
+	return more;
+}
+
+/*
+ * Drives the lexer to the end of the input or until a sink stops it.
+ * Returns the number of tokens handed to the sinks, EOF token included.
+ */
+size_t lexerRun(LexerInfo *lxer)
+{
+	size_t total = 0;
+	size_t n;
+
+	while (lexerDrive(lxer, &n))
+		total += n;
+	return total + n;
 }
 
 /* ============================================================
@@ -371,26 +1487,28 @@ Token nextToken(LexerInfo *lxer)
 Token delimHandler(LexerInfo *lxer)
 {
 	Token tok = {0};
-	char c = peek(lxer);
+	ScanSpan span;
 
 	tok.start = lxer->input + lxer->pos;
-	tok.length = 0;
-
-	do {
-		switch (c) {
-		case ' ':  tok.type = TOKEN_DELIM_S; break;
-		case '\t': tok.type = TOKEN_DELIM_T; break;
-		case '\n': tok.type = TOKEN_DELIM_N; break;
-		case '\v': tok.type = TOKEN_DELIM_V; break;
-		case '\f': tok.type = TOKEN_DELIM_F; break;
-		case '\r': tok.type = TOKEN_DELIM_R; break;
-		default:   tok.type = TOKEN_DELIM_U; break;
-		}
 
-		tok.length++;
-		advance(lxer);
+	/*
+	 * the whole run is measured in one go by the scan kernel. the token type
+	 * comes from the first whitespace character of the run like it always has
+	 */
+	span = scanWhitespace(tok.start, inputEnd(lxer));
+	tok.length = span.length;
+
+	switch (tok.start[0]) {
+	case ' ':  tok.type = TOKEN_DELIM_S; break;
+	case '\t': tok.type = TOKEN_DELIM_T; break;
+	case '\n': tok.type = TOKEN_DELIM_N; break;
+	case '\v': tok.type = TOKEN_DELIM_V; break;
+	case '\f': tok.type = TOKEN_DELIM_F; break;
+	case '\r': tok.type = TOKEN_DELIM_R; break;
+	default:   tok.type = TOKEN_DELIM_U; break;
+	}
 
-	} while (isspace(peek(lxer)) && !peekEoF(lxer));
+	advanceSpan(lxer, span);
 
 	return tok;
 }
@@ -425,7 +1543,7 @@ Token charHandler(LexerInfo *lxer)
 					tok.type = TOKEN_ERR;
 					tok.length++;
 					state = STRING_DONE;
-					reportLexerError(lxer, "Empty Character Literal"); 
+					reportLexerError(lxer, LEX_ERR_EMPTY_CHAR); 
 
 				}else if (peek(lxer) == '\\'){
 					/* code */
@@ -436,7 +1554,7 @@ Token charHandler(LexerInfo *lxer)
 					tok.length++;
 					//lxer->lines++;
 					state = STRING_DONE;
-					reportLexerError(lxer, "Unterminated Character Literal");
+					reportLexerError(lxer, LEX_ERR_UNTERMINATED_CHAR);
 				}else{
 					state = STRING_VALID;
 					tok.length++;
@@ -456,7 +1574,7 @@ Token charHandler(LexerInfo *lxer)
 					tok.length++;
 					//lxer->lines++;
 					state = STRING_DONE;
-					reportLexerError(lxer, "Escaped newline not valid character literal");
+					reportLexerError(lxer, LEX_ERR_CHAR_NEWLINE);
 				}else {
 					tok.length++;
 					charLitLen++;	
@@ -500,7 +1618,7 @@ Token charHandler(LexerInfo *lxer)
 				}else{
 					tok.type = TOKEN_ERR;
 					tok.length++;
-					reportLexerError(lxer, "Malformed Escape Character"); 
+					reportLexerError(lxer, LEX_ERR_CHAR_ESCAPE); 
 				}
 				break;
 
@@ -514,7 +1632,7 @@ Token charHandler(LexerInfo *lxer)
 				{
 
 					tok.type = TOKEN_ERR;
-					reportLexerError(lxer, "Character Literal too long"); 
+					reportLexerError(lxer, LEX_ERR_CHAR_TOO_LONG); 
 				}
 				
 				state = STRING_EXIT;
@@ -544,6 +1662,23 @@ Token stringHandler(LexerInfo *lxer)
 	//char c = advance(lxer);
 
 	while (!peekEoF(lxer) && state != STRING_EXIT) {
+		/*
+		 * fast path: in the middle of a string every plain byte just bumps the
+		 * length, so skip straight to the next byte the state machine cares
+		 * about. the byte under pos has already been looked at but not consumed
+		 * yet (it can be an escaped newline) so it goes through advance()
+		 */
+		if (state == STRING_VALID) {
+			ScanSpan span = scanStringBody(lxer->input + lxer->pos + 1, inputEnd(lxer));
+
+			if (span.length) {
+				tok.length += span.length;
+				advance(lxer);
+				span.length--;
+				advanceSpan(lxer, span);
+			}
+		}
+
 		//not using c to store the previos right now but keeping it for reference for later just in case
 		//char c = advance(lxer);
 		advance(lxer);
@@ -553,7 +1688,7 @@ Token stringHandler(LexerInfo *lxer)
 					tok.type = TOKEN_ERR;
 					tok.length++;
 					state = STRING_DONE;
-					reportLexerError(lxer, "Empty String Literal");  
+					reportLexerError(lxer, LEX_ERR_EMPTY_STRING);  
 
 				}else if (peek(lxer) == '\\'){
 					state = STRING_ESCAPE;
@@ -576,7 +1711,7 @@ Token stringHandler(LexerInfo *lxer)
 					tok.length++;
 
 					state = STRING_DONE;
-					reportLexerError(lxer, "Unterminated String"); 
+					reportLexerError(lxer, LEX_ERR_UNTERMINATED_STRING); 
 				}else {
 					tok.length++;	
 				}
@@ -620,7 +1755,7 @@ Token stringHandler(LexerInfo *lxer)
 				}else{
 					tok.type = TOKEN_ERR;
 					tok.length++;
-					reportLexerError(lxer, "Malformed escape character"); 
+					reportLexerError(lxer, LEX_ERR_STRING_ESCAPE); 
 				}
 				break;
 
@@ -645,23 +1780,37 @@ Token stringHandler(LexerInfo *lxer)
  * Handles identifiers and keywords.
  * Identifiers start with a letter and may contain digits.
  * Returns TOKEN_KEYWORD if found in keyword table.
+ * With lxer->symbols set identifiers also carry their interned id.
  */
 Token identHandler(LexerInfo *lxer)
 {
 	Token tok = {0};
+	uint32_t hash = INTERN_HASH_SEED;
 
 	tok.start = lxer->input + lxer->pos;
 	tok.length = 0;
 
-	while (!peekEoF(lxer) && (isalpha(peek(lxer)) || isdigit(peek(lxer)) || peek(lxer) == '_')) {
-		tok.length++;
-		advance(lxer);
+	if (lxer->symbols) {
+		/* hash on the way through so the intern table never rescans the name */
+		while (charIs(peek(lxer), CC_IDENT)) {
+			tok.length++;
+			hash = internHashStep(hash, (unsigned char)advance(lxer));
+		}
+	} else {
+		while (charIs(peek(lxer), CC_IDENT)) {
+			tok.length++;
+			advance(lxer);
+		}
 	}
 
-	if (lookUp(tok.start, tok.length))
+	tok.keyword = (uint8_t)lookUpPadded(tok.start, tok.length);
+	if (tok.keyword != KEYWRD_NONE) {
 		tok.type = TOKEN_KEYWORD;
-	else
+	} else {
 		tok.type = TOKEN_IDEN_GENERIC;
+		if (lxer->symbols)
+			tok.value.symbol = internHashed(lxer->symbols, tok.start, tok.length, hash);
+	}
 
 	return tok;
 }
@@ -804,9 +1953,9 @@ Token opHandler(LexerInfo *lxer)
 
 /*
  * Handles integer and floating-point literals in one pass.
- * later on the string thats been index can use stdlib funcs
- * to safely convert strings to ints or floats no need for me
- * to roll my own
+ * With lxer->decodeLiterals set the value is decoded right
+ * after the literal is classified (see numeric.c) so callers
+ * don't have to run strtol/strtod over the text again
  */
 Token numHandler(LexerInfo *lxer)
 {
@@ -819,39 +1968,39 @@ Token numHandler(LexerInfo *lxer)
 	tok.length = 0;
     NumState state = STATE_START;
 
-    while ( ( isxdigit(peek(lxer)) || isxblurf(peek(lxer)) ) && !peekEoF(lxer)  ){
+    while (charIs(peek(lxer), CC_XDIGIT | CC_NUMSUFFIX)) {
         char c = advance(lxer);
         switch (state) {
             case STATE_START:
-                if (c == '0' && isxblurf(peek(lxer))){
+                if (c == '0' && charIs(peek(lxer), CC_NUMSUFFIX)){
 
                         state = STATE_LITERAL;
                         tok.length++;
                 
-                }else if (c == '0' && isdigit(peek(lxer)))
+                }else if (c == '0' && charIs(peek(lxer), CC_DIGIT))
                 {
                     
                     state = STATE_ERR;
                     tok.length++;
 	
-                    reportLexerError(lxer, "Malformed Integer Literal");  
+                    reportLexerError(lxer, LEX_ERR_MALFORMED_INT);  
                 }else if (c == '.'){
                     state = STATE_FLOAT;
                     //advance();
                     tok.length++;
-                }else if (isdigit(c)){
+                }else if (charIs(c, CC_DIGIT)){
                     state = STATE_INT;
                     tok.length++;
                 }else{
                     state = STATE_ERR;
                     //advance();
                     tok.length++;
-                    reportLexerError(lxer, "Malformed unnamed Literal");                  
+                    reportLexerError(lxer, LEX_ERR_MALFORMED_UNNAMED);                  
                 }break;
                 
                 
              case STATE_LITERAL:
-                if (isoctal(c) ){
+                if (charIs(c, CC_OCT)){
                     state = STATE_OCT;
                     tok.length++;
                     
@@ -871,12 +2020,12 @@ Token numHandler(LexerInfo *lxer)
                     state = STATE_ERR;
                     //advance();
                     tok.length++;
-                    reportLexerError(lxer, "Malformed Literal General");                  
+                    reportLexerError(lxer, LEX_ERR_MALFORMED_LITERAL);                  
                 }break;               
                 
                 
             case STATE_INT:  
-                if (isdigit(c)){
+                if (charIs(c, CC_DIGIT)){
                     //advance();
                     tok.length++;
                 }else if (c == '.'){
@@ -886,22 +2035,22 @@ Token numHandler(LexerInfo *lxer)
                    // advance(); 
                     tok.length++;
                     state = STATE_ERR;
-                    reportLexerError(lxer, "Malformed Integer Literal");      
+                    reportLexerError(lxer, LEX_ERR_MALFORMED_INT);      
                 }break;
                 
             case STATE_FLOAT:  
-                if (isdigit(c)){
+                if (charIs(c, CC_DIGIT)){
                     //advance();
                     tok.length++;
                 }else{
                    // advance(); 
                     tok.length++;
                     state = STATE_ERR;  
-                    reportLexerError(lxer, "Malformed Float Literal");    
+                    reportLexerError(lxer, LEX_ERR_MALFORMED_FLOAT);    
                 }break;
                 
             case STATE_HEX:
-                if (isxdigit(c)){
+                if (charIs(c, CC_XDIGIT)){
 
                     //advance();
                     tok.length++;
@@ -910,29 +2059,29 @@ Token numHandler(LexerInfo *lxer)
                     //advance(); 
                     tok.length++;
                     state = STATE_ERR;
-                    reportLexerError(lxer, "Malformed Hex Literal");      
+                    reportLexerError(lxer, LEX_ERR_MALFORMED_HEX);      
                 }break; 
                 
             case STATE_BIN:
-                if (isbinary(c)){
+                if (charIs(c, CC_BIN)){
                     //advance();
                     tok.length++;
                 }else{
                     //advance(); 
                     tok.length++;
                     state = STATE_ERR;   
-                    reportLexerError(lxer, "Malformed Binary Literal");   
+                    reportLexerError(lxer, LEX_ERR_MALFORMED_BIN);   
                 }break;   
                 
             case STATE_OCT:
-                if (isoctal(c)){
+                if (charIs(c, CC_OCT)){
                     //advance();
                     tok.length++;
                 }else{
                     //advance(); 
                     tok.length++;
                     state = STATE_ERR; 
-                    reportLexerError(lxer, "Malformed Octal Literal");   
+                    reportLexerError(lxer, LEX_ERR_MALFORMED_OCT);   
                 }break; 
 
             case STATE_ERR:
@@ -974,6 +2123,9 @@ Token numHandler(LexerInfo *lxer)
             break;       
     }
 
+    if (lxer->decodeLiterals)
+        decodeNumber(&tok);
+
     return tok;
 }
 
@@ -989,25 +2141,46 @@ char advance(LexerInfo *lxer)
 	if (peekEoF(lxer))
 		return '\0';
 
-    if (peek(lxer) == '\n'){
-        lxer->lines++;
-        lxer->cols = 0;
-    }else{
-        lxer->cols++;
+    /* in lazy mode positions come from the line index when someone asks */
+    if (!lxer->lazyPositions) {
+        if (peek(lxer) == '\n'){
+            lxer->lines++;
+            lxer->cols = 0;
+        }else{
+            lxer->cols++;
+        }
     }
 
 	return lxer->input[lxer->pos++];
 }
 
 /*
- * Returns the current character without advancing the lexer.
+ * Moves the lexer over a span measured by one of the scan kernels and does
+ * the same line/column bookkeeping advance() would have done per character.
  */
-char peek(LexerInfo *lxer)
+static void advanceSpan(LexerInfo *lxer, ScanSpan span)
 {
-    /*
-        TODO: Add some sort of bounds checking here. Maybe get the length of the input string thats being lexed
-    */
+	lxer->pos += span.length;
+
+	if (lxer->lazyPositions)
+		return;
 
+	if (span.newlines) {
+		lxer->lines += span.newlines;
+		lxer->cols = span.length - span.lastNewline - 1;
+	} else {
+		lxer->cols += span.length;
+	}
+}
+
+/*
+ * Returns the current character without advancing the lexer, '\0' once
+ * the lexer is at the end of the input.
+ */
+char peek(LexerInfo *lxer)
+{
+	if (lxer->pos >= lxer->length)
+		return '\0';
 	return lxer->input[lxer->pos];
 }
 
@@ -1016,7 +2189,7 @@ char peek(LexerInfo *lxer)
  */
 char peekNext(LexerInfo *lxer)
 {
-	if (peek(lxer) == '\0')
+	if (lxer->pos + 1 >= lxer->length)
 		return '\0';
 	return lxer->input[lxer->pos + 1];
 }
@@ -1036,7 +2209,7 @@ char peekPrev(LexerInfo *lxer)
  */
 bool peekEoF(LexerInfo *lxer)
 {
-	return peek(lxer) == '\0';
+	return lxer->pos >= lxer->length;
 }
 
 /* ============================================================
@@ -1061,13 +2234,280 @@ void printTokenType(Token tok)
 	printf("\n");
 }
 
+/* lexer sink that prints every token with printTokenType */
+bool printTokenSink(const Token *tokens, size_t count, void *userData)
+{
+	(void)userData;
+	for (size_t i = 0; i < count; i++)
+		printTokenType(tokens[i]);
+	return true;
+}
+
+static const char *branchNames[LEXER_BRANCH_COUNT] = {
+	"line comment", "block comment", "delim", "number", "ident", "punct",
+	"operator", "string", "char", "eof", "unknown"
+};
+
+/*
+ * Prints the non zero counters of a LexerStats.
+ */
+void printLexerStats(const LexerStats *stats)
+{
+	printf("%-18s %12s\n", "token", "count");
+	for (size_t i = 0; i < TOKEN_COUNT; i++) {
+		if (stats->tokens[i])
+			printf("%-18s %12llu\n", tokenTypeNames[i], (unsigned long long)stats->tokens[i]);
+	}
+
+	printf("\n%-18s %12s %12s %14s\n", "branch", "tokens", "bytes", "cycles");
+	for (size_t i = 0; i < LEXER_BRANCH_COUNT; i++) {
+		if (stats->branchTokens[i])
+			printf("%-18s %12llu %12llu %14llu\n", branchNames[i],
+			       (unsigned long long)stats->branchTokens[i],
+			       (unsigned long long)stats->branchBytes[i],
+			       (unsigned long long)stats->branchCycles[i]);
+	}
+
+	if (stats->errorKinds) {
+		printf("\n%-40s %12s\n", "error", "count");
+		for (size_t i = 0; i < stats->errorKinds; i++)
+			printf("%-40s %12llu\n", stats->errors[i].message,
+			       (unsigned long long)stats->errors[i].count);
+		if (stats->errorsOther)
+			printf("%-40s %12llu\n", "(other)", (unsigned long long)stats->errorsOther);
+	}
+}
+
+
+
+/*
+ * Raises an error at the current position, see lexerReportAt.
+ */
+void reportLexerError(LexerInfo *lex, LexerErrorCode code) {
+#ifdef LEXER_STATS
+    statsCountError(&lex->stats, errorMessages[code], 1);
+#endif
+
+    lexerReportAt(lex, lex->pos, code);
+}
+
+/*
+ * Appends one record to the diagnostics buffer. Returns false if it could
+ * not grow.
+ */
+static bool recordDiagnostic(LexerInfo *lex, size_t offset, LexerErrorCode code)
+{
+	if (lex->diagnosticCount == lex->diagnosticCap) {
+		size_t cap = lex->diagnosticCap ? lex->diagnosticCap * 2 : 64;
+		LexerDiagnostic *grown = realloc(lex->diagnostics, cap * sizeof(*grown));
+
+		if (!grown)
+			return false;
+		lex->diagnostics = grown;
+		lex->diagnosticCap = cap;
+	}
+
+	lex->diagnostics[lex->diagnosticCount].offset = offset;
+	lex->diagnostics[lex->diagnosticCount].code = (uint8_t)code;
+	lex->diagnosticCount++;
+	return true;
+}
+
+/*
+ * Raises an error for the character before offset. Past maxErrors it is
+ * only counted. With bufferDiagnostics it is recorded for
+ * lexerFlushDiagnostics, otherwise errorFn is called right away.
+ */
+void lexerReportAt(LexerInfo *lex, size_t offset, LexerErrorCode code)
+{
+	size_t line = lex->lines;
+	size_t col = lex->cols;
+
+	lex->errorCount++;
+	if (lex->maxErrors && lex->errorCount > lex->maxErrors)
+		return;
 
+	/* out of memory falls through and hands this one over now */
+	if (lex->bufferDiagnostics && recordDiagnostic(lex, offset, code))
+		return;
 
-void reportLexerError(LexerInfo *lex, const char *msg) {
     if (lex->errorFn) {
-        lex->errorFn(lex->lines, lex->cols, msg, lex->errorUserData, &lex->input[lex->pos-1]);
+        if (lex->lazyPositions || offset != lex->pos)
+            lexerResolvePosition(lex, offset, &line, &col);
+        lex->errorFn(line, col, errorMessages[code], lex->errorUserData, &lex->input[offset-1]);
     }
 
     // handle a fail state here right now if the functions pointer 
     // in the lexer structure is null it jsut falls tru
-}
\ No newline at end of file
+}
+
+/*
+ * Hands every buffered record to errorFn in the order they were raised
+ * and empties the buffer. Has to run before the input changes since the
+ * positions are resolved against it. Returns how many were delivered.
+ */
+size_t lexerFlushDiagnostics(LexerInfo *lex)
+{
+	size_t n = lex->diagnosticCount;
+
+	for (size_t i = 0; lex->errorFn && i < n; i++) {
+		const LexerDiagnostic *d = &lex->diagnostics[i];
+		size_t line = 0, col = 0;
+
+		lexerResolvePosition(lex, d->offset, &line, &col);
+		lex->errorFn(line, col, errorMessages[d->code], lex->errorUserData,
+		             &lex->input[d->offset - 1]);
+	}
+
+	lex->diagnosticCount = 0;
+	return n;
+}
+
+/*
+ * Message errorFn receives for code.
+ */
+const char *lexerErrorMessage(LexerErrorCode code)
+{
+	if ((unsigned)code >= LEX_ERR_COUNT)
+		return "Unknown error";
+	return errorMessages[code];
+}
+
+/* ============================================================
+   ====================== POSITION INDEX ======================
+   ============================================================ */
+
+/*
+ * Builds the table of line start offsets for the whole input with the
+ * newline scan kernels. Used by lazyPositions mode instead of counting
+ * lines/cols on every advance(). The table of an earlier input is written
+ * over when it is big enough. Returns false if it could not allocate.
+ */
+bool lexerBuildLineIndex(LexerInfo *lxer)
+{
+	size_t len = lxer->length;
+	size_t newlines = scanCountNewlines(lxer->input, len);
+
+	if (newlines + 1 > lxer->lineCap) {
+		size_t *starts = malloc((newlines + 1) * sizeof(size_t));
+
+		if (!starts)
+			return false;
+		free(lxer->lineStarts);
+		lxer->lineStarts = starts;
+		lxer->lineCap = newlines + 1;
+	}
+
+	lxer->lineStarts[0] = 0;
+	scanLineStarts(lxer->input, len, lxer->lineStarts + 1);
+	lxer->lineCount = newlines + 1;
+	return true;
+}
+
+/*
+ * Turns an offset into the line/column advance() would have tracked when
+ * the lexer got there: lines counts from 1 and cols is the number of
+ * characters since the last newline. The index is built on first use.
+ */
+bool lexerResolvePosition(LexerInfo *lxer, size_t offset, size_t *line, size_t *col)
+{
+	size_t lo = 0, hi;
+
+	if (!lxer->lineCount && !lexerBuildLineIndex(lxer))
+		return false;
+
+	/* last line start at or before offset */
+	hi = lxer->lineCount;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (lxer->lineStarts[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	*line = lo + 1;
+	*col = offset - lxer->lineStarts[lo];
+	return true;
+}
+
+/* ============================================================
+   ===================== INSTRUMENTATION ======================
+   ============================================================ */
+
+#ifdef LEXER_STATS
+/*
+ * Adds n reports of msg. Messages are matched by text so the same message
+ * raised from two places is one entry.
+ */
+static void statsCountError(LexerStats *stats, const char *msg, uint64_t n)
+{
+	for (size_t i = 0; i < stats->errorKinds; i++) {
+		if (stats->errors[i].message == msg || strcmp(stats->errors[i].message, msg) == 0) {
+			stats->errors[i].count += n;
+			return;
+		}
+	}
+
+	if (stats->errorKinds == LEXER_STATS_MAX_MESSAGES) {
+		stats->errorsOther += n;
+		return;
+	}
+	stats->errors[stats->errorKinds].message = msg;
+	stats->errors[stats->errorKinds].count = n;
+	stats->errorKinds++;
+}
+#endif
+
+/*
+ * Copies the lexer's counters into out. Returns false, with out zeroed,
+ * when the library was built without LEXER_STATS.
+ */
+bool lexerGetStats(const LexerInfo *lxer, LexerStats *out)
+{
+#ifdef LEXER_STATS
+	*out = lxer->stats;
+	return true;
+#else
+	(void)lxer;
+	memset(out, 0, sizeof(*out));
+	return false;
+#endif
+}
+
+/*
+ * Zeroes the counters. lexerReset() keeps them so a reused lexer adds up
+ * over all of its inputs.
+ */
+void lexerResetStats(LexerInfo *lxer)
+{
+#ifdef LEXER_STATS
+	memset(&lxer->stats, 0, sizeof(lxer->stats));
+#else
+	(void)lxer;
+#endif
+}
+
+/*
+ * Adds the counters in from to into, used to sum up lexers that ran on
+ * other threads.
+ */
+void lexerMergeStats(LexerStats *into, const LexerStats *from)
+{
+#ifdef LEXER_STATS
+	for (size_t i = 0; i < TOKEN_COUNT; i++)
+		into->tokens[i] += from->tokens[i];
+	for (size_t i = 0; i < LEXER_BRANCH_COUNT; i++) {
+		into->branchTokens[i] += from->branchTokens[i];
+		into->branchBytes[i] += from->branchBytes[i];
+		into->branchCycles[i] += from->branchCycles[i];
+	}
+	for (size_t i = 0; i < from->errorKinds; i++)
+		statsCountError(into, from->errors[i].message, from->errors[i].count);
+	into->errorsOther += from->errorsOther;
+#else
+	(void)into;
+	(void)from;
+#endif
+}
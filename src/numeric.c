@@ -0,0 +1,245 @@
+/******************************************************************************
+* File:        numeric.c
+* Date:        04-06-26
+*
+* Description: Lexer project
+*
+* Notes: Numeric literal decoding. Runs of 8 digits are loaded as one 64 bit
+*        word and folded into their value with a few shifts and multiplies
+*        (SWAR) instead of one multiply-add per digit. The word tricks
+*        assume a little endian load, other targets use the digit loop.
+*        Floats with at most 15 significant digits and 22 fraction digits
+*        are exact as mantissa / 10^n (Clinger's fast path), anything
+*        else goes through strtod.
+******************************************************************************/
+#include "numeric.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NUMERIC_SWAR 1
+#endif
+
+#define FAST_FLOAT_DIGITS 15
+#define FAST_FLOAT_POW10  22
+
+static const double pow10Table[FAST_FLOAT_POW10 + 1] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* ============================================================
+   ===================== 8 DIGIT KERNELS ======================
+   ============================================================ */
+
+#ifdef NUMERIC_SWAR
+
+static inline uint64_t loadEight(const char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+/*
+ * "12345678" -> 12345678. Adjacent digits are merged into pairs, then
+ * pairs of pairs, each step doubling the width of a lane.
+ */
+static inline uint32_t decEight(const char *p)
+{
+	uint64_t v = loadEight(p) - 0x3030303030303030ULL;
+
+	v = (v * 10) + (v >> 8);
+	v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+	     (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+	return (uint32_t)v;
+}
+
+/*
+ * "deadBEEF" -> 0xdeadbeef. Letters have bit 6 set, adding 9 to their low
+ * nibble gives 10-15. The nibbles are then packed the same way as decEight.
+ */
+static inline uint32_t hexEight(const char *p)
+{
+	uint64_t v = loadEight(p);
+	uint64_t letter = (v & 0x4040404040404040ULL) >> 6;
+
+	v = (v & 0x0F0F0F0F0F0F0F0FULL) + letter * 9;
+	v = ((v << 4) & 0x00F000F000F000F0ULL) | ((v >> 8) & 0x000F000F000F000FULL);
+	v = ((v << 8) & 0x0000FF000000FF00ULL) | ((v >> 16) & 0x000000FF000000FFULL);
+	return (uint32_t)(((v & 0xFFFF) << 16) | ((v >> 32) & 0xFFFF));
+}
+
+/*
+ * "01234567" -> 01234567 (24 bits).
+ */
+static inline uint32_t octEight(const char *p)
+{
+	uint64_t v = loadEight(p) - 0x3030303030303030ULL;
+
+	v = ((v << 3) & 0x0038003800380038ULL) | ((v >> 8) & 0x0007000700070007ULL);
+	v = ((v << 6) & 0x00000FC000000FC0ULL) | ((v >> 16) & 0x0000003F0000003FULL);
+	return (uint32_t)(((v & 0xFFF) << 12) | ((v >> 32) & 0xFFF));
+}
+
+/*
+ * "10110011" -> 0xB3. The multiply drops bit i of the word into bit 7-i of
+ * the top byte; every other partial product lands on its own bit below it
+ * or falls off the top, so nothing carries in.
+ */
+static inline uint32_t binEight(const char *p)
+{
+	uint64_t v = loadEight(p) - 0x3030303030303030ULL;
+
+	return (uint32_t)((v * 0x8040201008040201ULL) >> 56);
+}
+
+#endif /* NUMERIC_SWAR */
+
+/* ============================================================
+   ====================== INTEGER DECODE ======================
+   ============================================================ */
+
+static inline unsigned digitValue(char c)
+{
+	if (c >= '0' && c <= '9')
+		return (unsigned)(c - '0');
+	return (unsigned)((c | 0x20) - 'a' + 10);
+}
+
+/*
+ * Accumulates len digits of the given base (2, 8, 10 or 16) starting at p.
+ * Sets *overflow and saturates once the value passes UINT64_MAX.
+ */
+static uint64_t parseDigits(const char *p, size_t len, unsigned base, bool *overflow)
+{
+	uint64_t value = 0;
+	size_t i = 0;
+
+#ifdef NUMERIC_SWAR
+	uint64_t scale = base == 10 ? 100000000ULL : (uint64_t)1 << (base == 16 ? 32 : base == 8 ? 24 : 8);
+
+	for (; i + 8 <= len; i += 8) {
+		uint32_t chunk;
+
+		switch (base) {
+			case 16: chunk = hexEight(p + i); break;
+			case 8:  chunk = octEight(p + i); break;
+			case 2:  chunk = binEight(p + i); break;
+			default: chunk = decEight(p + i); break;
+		}
+		if (__builtin_mul_overflow(value, scale, &value) ||
+		    __builtin_add_overflow(value, chunk, &value)) {
+			*overflow = true;
+			return UINT64_MAX;
+		}
+	}
+#endif
+
+	for (; i < len; i++) {
+		if (__builtin_mul_overflow(value, (uint64_t)base, &value) ||
+		    __builtin_add_overflow(value, digitValue(p[i]), &value)) {
+			*overflow = true;
+			return UINT64_MAX;
+		}
+	}
+
+	return value;
+}
+
+/*
+ * Skips the leading 0 and the radix letter (x, b, o) of a prefixed literal.
+ * A bare leading 0 on an octal literal is skipped as well, it adds nothing.
+ */
+static size_t prefixLength(const Token *tok)
+{
+	if (tok->length >= 2 && tok->start[0] == '0' && !(tok->start[1] >= '0' && tok->start[1] <= '9'))
+		return 2;
+	return tok->length >= 1 && tok->start[0] == '0' ? 1 : 0;
+}
+
+/* ============================================================
+   ======================= FLOAT DECODE =======================
+   ============================================================ */
+
+/*
+ * Digits '.' digits, either side may be empty. The fast path folds all
+ * digits into one integer mantissa and divides by 10^fraction once, which
+ * is correctly rounded while both fit exactly in a double.
+ */
+static double parseFloat(const char *p, size_t len, bool *overflow)
+{
+	const char *dot = memchr(p, '.', len);
+	size_t intLen = dot ? (size_t)(dot - p) : len;
+	size_t fracLen = dot ? len - intLen - 1 : 0;
+	size_t lead = 0;
+
+	/* leading zeros don't count against the exact digit budget */
+	while (lead < intLen && p[lead] == '0')
+		lead++;
+
+	if (intLen - lead + fracLen <= FAST_FLOAT_DIGITS && fracLen <= FAST_FLOAT_POW10) {
+		bool unused = false;
+		uint64_t mantissa = parseDigits(p + lead, intLen - lead, 10, &unused);
+
+		mantissa = mantissa * (uint64_t)pow10Table[fracLen] +
+		           parseDigits(p + intLen + 1, fracLen, 10, &unused);
+		return (double)mantissa / pow10Table[fracLen];
+	}
+
+	/* slow path, strtod needs its own terminated copy */
+	char small[64];
+	char *text = len < sizeof small ? small : malloc(len + 1);
+	double value;
+
+	if (!text)
+		return 0.0;
+	memcpy(text, p, len);
+	text[len] = '\0';
+
+	errno = 0;
+	value = strtod(text, NULL);
+	if (errno == ERANGE && isinf(value))
+		*overflow = true;
+
+	if (text != small)
+		free(text);
+	return value;
+}
+
+/* ============================================================
+   ======================== ENTRY POINT =======================
+   ============================================================ */
+
+void decodeNumber(Token *tok)
+{
+	bool overflow = false;
+	size_t skip;
+
+	switch (tok->type) {
+		case TOKEN_INT:
+			tok->value.intVal = parseDigits(tok->start, tok->length, 10, &overflow);
+			break;
+
+		case TOKEN_HEX:
+		case TOKEN_OCT:
+		case TOKEN_BIN:
+			skip = prefixLength(tok);
+			tok->value.intVal = parseDigits(tok->start + skip, tok->length - skip,
+			                                tok->type == TOKEN_HEX ? 16 : tok->type == TOKEN_OCT ? 8 : 2,
+			                                &overflow);
+			break;
+
+		case TOKEN_FLOAT:
+			tok->value.floatVal = parseFloat(tok->start, tok->length, &overflow);
+			break;
+
+		default:
+			return;
+	}
+
+	if (overflow)
+		tok->flags |= TOKEN_FLAG_OVERFLOW;
+}
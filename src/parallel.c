@@ -0,0 +1,422 @@
+/******************************************************************************
+* File:        parallel.c
+* Date:        03-16-26
+*
+* Description: Lexer project
+*
+* Notes: Parallel lexing of a single input. The input is cut into segments
+*        that start right after a newline and every worker lexes its segment
+*        as if it started outside of any comment or string. Lexing is
+*        stateless between tokens, so a segment's tokens are right from the
+*        first one that starts where the previous segment's last token
+*        ended. The merge walks the segments in order and when a guess was
+*        wrong (a comment or string crossed the cut) it re-lexes from the
+*        real boundary until it lands on a token start the worker also
+*        produced, then takes the rest of the worker's tokens as they are.
+*
+*        Because every segment starts at the beginning of a line a worker
+*        only needs its local line number, the global one is its local line
+*        plus the newlines in front of the segment.
+******************************************************************************/
+#define _DEFAULT_SOURCE
+
+#include "parallel.h"
+#include "intern.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* an error held back until the merge knows its token is real */
+typedef struct {
+    LexerDiagnostic diag;
+    size_t tokStart;    /* start of the token being lexed when it was raised */
+} SegmentError;
+
+typedef struct {
+    const char *input;
+    size_t length;      /* bytes of the whole input                    */
+    size_t start;       /* first byte of the segment                   */
+    size_t end;         /* one past the last token start it may emit   */
+    size_t exitPos;     /* where its last token ended                  */
+    size_t lineBase;    /* global line number of the segment's line 1  */
+    bool last;
+    bool ok;
+    TokenBuffer tokens;
+    SegmentError *errors;
+    size_t errorCount;
+    size_t errorCap;
+    size_t curTokStart;
+    struct InternTable *symbols;
+    bool tableDriven;
+#ifdef LEXER_STATS
+    LexerStats stats;   /* includes tokens the merge throws away */
+#endif
+} Segment;
+
+/* ============================================================
+   ========================= WORKERS ==========================
+   ============================================================ */
+
+/*
+ * Moves the records the worker's lexer buffered for the token it just
+ * lexed over to the segment, tagged with where that token started.
+ */
+static void takeDiagnostics(Segment *seg, LexerInfo *lx)
+{
+	for (size_t i = 0; i < lx->diagnosticCount; i++) {
+		if (seg->errorCount == seg->errorCap) {
+			size_t cap = seg->errorCap ? seg->errorCap * 2 : 16;
+			SegmentError *grown = realloc(seg->errors, cap * sizeof(*grown));
+
+			if (!grown) {
+				seg->ok = false;
+				return;
+			}
+			seg->errors = grown;
+			seg->errorCap = cap;
+		}
+
+		seg->errors[seg->errorCount].diag = lx->diagnostics[i];
+		seg->errors[seg->errorCount].tokStart = seg->curTokStart;
+		seg->errorCount++;
+	}
+	lx->diagnosticCount = 0;
+}
+
+/*
+ * Appends one token to a buffer, growing it when needed.
+ */
+static bool pushToken(TokenBuffer *buf, const char *input, Token tok)
+{
+	if (buf->count == buf->capacity &&
+	    !tokenBufferReserve(buf, buf->capacity ? buf->capacity * 2 : 1024))
+		return false;
+
+	buf->types[buf->count] = (uint8_t)tok.type;
+	buf->offsets[buf->count] = (uint32_t)(tok.start - input);
+	buf->lengths[buf->count] = (uint32_t)tok.length;
+	if (buf->symbols)
+		buf->symbols[buf->count] = tok.type == TOKEN_IDEN_GENERIC ? tok.value.symbol : SYMBOL_NONE;
+	buf->count++;
+	return true;
+}
+
+/*
+ * Lexes one segment. Tokens are emitted while they start before seg->end,
+ * the last one may run past it.
+ */
+static void *lexSegment(void *arg)
+{
+	Segment *seg = arg;
+	LexerInfo lx = {0};
+	Token tok;
+
+	lx.input = seg->input;
+	lx.length = seg->length;
+	lx.pos = seg->start;
+	lx.lines = 1;
+	/* errors are only kept as offsets, positions are worked out at the merge */
+	lx.lazyPositions = true;
+	lx.bufferDiagnostics = true;
+	/* the intern table is shared, every worker adds to the same one */
+	lx.symbols = seg->symbols;
+	lx.tableDriven = seg->tableDriven;
+	if (lx.symbols && !tokenBufferTrackSymbols(&seg->tokens))
+		seg->ok = false;
+
+	while (seg->ok && (seg->last || lx.pos < seg->end)) {
+		seg->curTokStart = lx.pos;
+		tok = nextToken(&lx);
+		if (lx.diagnosticCount)
+			takeDiagnostics(seg, &lx);
+		if (!pushToken(&seg->tokens, seg->input, tok))
+			seg->ok = false;
+		if (tok.type == TOKEN_EOF)
+			break;
+	}
+
+	seg->exitPos = lx.pos;
+#ifdef LEXER_STATS
+	seg->stats = lx.stats;
+#endif
+	free(lx.diagnostics);
+	return NULL;
+}
+
+/* ============================================================
+   ========================== MERGE ===========================
+   ============================================================ */
+
+static size_t countNewlines(const char *p, size_t len)
+{
+	size_t n = 0;
+	const char *end = p + len;
+
+	while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+		n++;
+		p++;
+	}
+	return n;
+}
+
+/*
+ * Works out the real lines/cols at pos inside a segment that starts a line.
+ */
+static void positionAt(const Segment *seg, size_t pos, size_t *lines, size_t *cols)
+{
+	const char *in = seg->input;
+	size_t i = pos;
+
+	*lines = seg->lineBase + countNewlines(in + seg->start, pos - seg->start);
+
+	while (i > seg->start && in[i - 1] != '\n')
+		i--;
+	*cols = pos - i;
+}
+
+/*
+ * Whether nextToken() under triviaMask would have skipped a token of this type.
+ */
+static bool isTrivia(uint64_t triviaMask, unsigned type)
+{
+	return type != TOKEN_EOF && (triviaMask & LEXER_TRIVIA(type));
+}
+
+/*
+ * Copies the worker's tokens from index k on and replays the errors that
+ * belong to them.
+ */
+static bool acceptFrom(const Segment *seg, size_t k, TokenBuffer *out, LexerInfo *lxer)
+{
+	size_t n = seg->tokens.count - k;
+	size_t first = n ? seg->tokens.offsets[k] : SIZE_MAX;
+
+	if (!tokenBufferReserve(out, out->count + n))
+		return false;
+
+	if (!lxer->triviaMask) {
+		memcpy(out->types + out->count, seg->tokens.types + k, n);
+		memcpy(out->offsets + out->count, seg->tokens.offsets + k, n * sizeof(uint32_t));
+		memcpy(out->lengths + out->count, seg->tokens.lengths + k, n * sizeof(uint32_t));
+		if (out->symbols)
+			memcpy(out->symbols + out->count, seg->tokens.symbols + k, n * sizeof(uint32_t));
+		out->count += n;
+	} else {
+		/* workers keep trivia so the streams can meet, it is dropped here */
+		for (size_t t = k; t < seg->tokens.count; t++) {
+			if (isTrivia(lxer->triviaMask, seg->tokens.types[t]))
+				continue;
+			out->types[out->count] = seg->tokens.types[t];
+			out->offsets[out->count] = seg->tokens.offsets[t];
+			out->lengths[out->count] = seg->tokens.lengths[t];
+			if (out->symbols)
+				out->symbols[out->count] = seg->tokens.symbols[t];
+			out->count++;
+		}
+	}
+
+	for (size_t e = 0; e < seg->errorCount; e++) {
+		const SegmentError *err = &seg->errors[e];
+
+		if (err->tokStart >= first)
+			lexerReportAt(lxer, err->diag.offset, (LexerErrorCode)err->diag.code);
+	}
+	return true;
+}
+
+/*
+ * Index of the first worker token that starts at or after pos.
+ */
+static size_t firstTokenAt(const Segment *seg, size_t pos)
+{
+	size_t lo = 0, hi = seg->tokens.count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (seg->tokens.offsets[mid] < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* ============================================================
+   ======================= ENTRY POINT ========================
+   ============================================================ */
+
+size_t lexerTokenizeParallel(LexerInfo *lxer, TokenBuffer *buf, unsigned threads)
+{
+	const char *input = lxer->input;
+	size_t begin = lxer->pos;
+	size_t len = lxer->length;
+	size_t before = buf->count;
+	size_t lines = lxer->lines, cols = lxer->cols;
+	size_t errorCount = lxer->errorCount, diagnosticCount = lxer->diagnosticCount;
+	size_t nseg, frontier, i;
+	Segment *segs;
+	pthread_t *tids;
+	bool ok = true;
+
+	if (threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = online > 0 ? (unsigned)online : 1;
+	}
+	if ((len - begin) / LEXER_PARALLEL_MIN_SEGMENT < threads)
+		threads = (unsigned)((len - begin) / LEXER_PARALLEL_MIN_SEGMENT);
+	/* where the error limit kicks in depends on every error before it */
+	if (threads < 2 || len > UINT32_MAX || lxer->maxErrors)
+		return lexerTokenizeAll(lxer, buf);
+
+	if (lxer->symbols && !tokenBufferTrackSymbols(buf))
+		return 0;
+
+	segs = calloc(threads, sizeof(Segment));
+	tids = calloc(threads, sizeof(pthread_t));
+	if (!segs || !tids) {
+		free(segs);
+		free(tids);
+		return lexerTokenizeAll(lxer, buf);
+	}
+
+	/* cut right after a newline near every 1/threads mark */
+	nseg = 0;
+	for (i = 0; i < threads; i++) {
+		size_t cut = begin + (len - begin) / threads * i;
+
+		if (i > 0) {
+			const char *nl = memchr(input + cut, '\n', len - cut);
+
+			if (!nl)
+				break;
+			cut = (size_t)(nl - input) + 1;
+			if (cut <= segs[nseg - 1].start || cut >= len)
+				continue;
+		}
+
+		segs[nseg].input = input;
+		segs[nseg].length = len;
+		segs[nseg].start = cut;
+		segs[nseg].symbols = lxer->symbols;
+		segs[nseg].tableDriven = lxer->tableDriven;
+		segs[nseg].ok = true;
+		nseg++;
+	}
+
+	for (i = 0; i < nseg; i++) {
+		segs[i].end = i + 1 < nseg ? segs[i + 1].start : len + 1;
+		segs[i].last = i + 1 == nseg;
+		segs[i].lineBase = i == 0 ? lxer->lines
+		                  : segs[i - 1].lineBase + countNewlines(input + segs[i - 1].start,
+		                                                         segs[i].start - segs[i - 1].start);
+	}
+
+	/* segment 0 runs on the calling thread */
+	for (i = 1; i < nseg; i++) {
+		if (pthread_create(&tids[i], NULL, lexSegment, &segs[i]) != 0) {
+			tids[i] = 0;
+			lexSegment(&segs[i]);
+		}
+	}
+	lexSegment(&segs[0]);
+	for (i = 1; i < nseg; i++) {
+		if (tids[i])
+			pthread_join(tids[i], NULL);
+	}
+
+	for (i = 0; i < nseg; i++) {
+		ok = ok && segs[i].ok;
+#ifdef LEXER_STATS
+		lexerMergeStats(&lxer->stats, &segs[i].stats);
+#endif
+	}
+
+	if (ok)
+		ok = acceptFrom(&segs[0], 0, buf, lxer);
+	frontier = segs[0].exitPos;
+
+	for (i = 1; ok && i < nseg; i++) {
+		Segment *seg = &segs[i];
+		uint64_t triviaMask = lxer->triviaMask;
+		size_t k;
+		Token tok;
+
+		if (frontier >= seg->end)
+			continue;
+
+		k = firstTokenAt(seg, frontier);
+		if (k < seg->tokens.count && seg->tokens.offsets[k] == frontier) {
+			ok = acceptFrom(seg, k, buf, lxer);
+			frontier = seg->exitPos;
+			continue;
+		}
+
+		/*
+		 * The worker guessed wrong, lex for real until the streams meet
+		 * again. This runs on lxer itself so its errors land in the same
+		 * records as acceptFrom's, only the position and the trivia mask
+		 * are borrowed and the position is set for real at the end.
+		 */
+		lxer->triviaMask = 0;
+		lxer->pos = frontier;
+		positionAt(seg, frontier, &lxer->lines, &lxer->cols);
+
+		for (;;) {
+			tok = nextToken(lxer);
+			if (!isTrivia(triviaMask, tok.type) && !pushToken(buf, input, tok)) {
+				ok = false;
+				break;
+			}
+			if (tok.type == TOKEN_EOF || (!seg->last && lxer->pos >= seg->end)) {
+				frontier = lxer->pos;
+				break;
+			}
+
+			while (k < seg->tokens.count && seg->tokens.offsets[k] < lxer->pos)
+				k++;
+			if (k < seg->tokens.count && seg->tokens.offsets[k] == lxer->pos) {
+				lxer->triviaMask = triviaMask;
+				ok = acceptFrom(seg, k, buf, lxer);
+				frontier = seg->exitPos;
+				break;
+			}
+		}
+		lxer->triviaMask = triviaMask;
+	}
+
+	for (i = 0; i < nseg; i++) {
+		tokenBufferFree(&segs[i].tokens);
+		free(segs[i].errors);
+	}
+	free(segs);
+	free(tids);
+
+	if (!ok) {
+		/* out of memory somewhere, fall back to one thread from a clean slate */
+		buf->count = before;
+		lxer->pos = begin;
+		lxer->lines = lines;
+		lxer->cols = cols;
+		lxer->errorCount = errorCount;
+		lxer->diagnosticCount = diagnosticCount;
+		return lexerTokenizeAll(lxer, buf);
+	}
+
+	/* leave the lexer where a sequential run would have */
+	{
+		size_t newlines = countNewlines(input + begin, len - begin);
+		size_t j = len;
+
+		while (j > begin && input[j - 1] != '\n')
+			j--;
+
+		lxer->lines = lines + newlines;
+		lxer->cols = newlines ? len - j : cols + (len - begin);
+		lxer->pos = len;
+	}
+
+	return buf->count - before;
+}
@@ -0,0 +1,165 @@
+/******************************************************************************
+* File:        relex.c
+* Date:        03-30-26
+*
+* Description: Lexer project
+*
+* Notes: Incremental re-lexing. A handler never looks further than the byte
+*        right after its token, so every token that ends before the edit is
+*        still valid. Lexing restarts at the first token that ends at or
+*        after the edit and stops as soon as a new token ends exactly where
+*        an old token behind the edit started (shifted by the size change).
+*        From there the old and new text are the same and lexing is
+*        stateless between tokens, so the rest of the old stream is reused.
+*        An edit that opens a comment or string simply keeps going until
+*        the two streams meet again, or to the end of the input.
+******************************************************************************/
+#include "relex.h"
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Index of the first token that ends at or after offset.
+ */
+static size_t firstTokenEndingAt(const TokenBuffer *buf, size_t offset)
+{
+	size_t lo = 0, hi = buf->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if ((size_t)buf->offsets[mid] + buf->lengths[mid] < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Sets lines/cols for a lexer that starts at pos. Only needed for error
+ * positions so it is skipped when nobody listens for errors.
+ */
+static void seekPosition(LexerInfo *lxer, size_t pos)
+{
+	const char *p = lxer->input;
+	const char *end = p + pos;
+	const char *lineStart = p;
+	const char *nl;
+
+	lxer->pos = pos;
+	lxer->lines = 1;
+	lxer->cols = 0;
+
+	/* the text changed so a lazy line index is stale, it is rebuilt in place */
+	lxer->lineCount = 0;
+
+	if (!lxer->errorFn || lxer->lazyPositions || lxer->bufferDiagnostics)
+		return;
+
+	while ((nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+		lxer->lines++;
+		p = nl + 1;
+		lineStart = p;
+	}
+	lxer->cols = (size_t)(end - lineStart);
+}
+
+bool lexerRelex(LexerInfo *lxer, TokenBuffer *buf, size_t editOffset,
+                size_t deletedLen, size_t insertedLen, RelexRange *range)
+{
+	TokenBuffer fresh;
+	long long delta = (long long)insertedLen - (long long)deletedLen;
+	size_t editEnd = editOffset + deletedLen;
+	size_t first = firstTokenEndingAt(buf, editOffset);
+	size_t restart;
+	size_t k, tail, newCount;
+
+	lxer->length = (size_t)((long long)lxer->length + delta);
+
+	if (first == buf->count)
+		first = 0;
+	/* right after the token before, so skipped trivia in between is lexed again */
+	restart = first ? buf->offsets[first - 1] + buf->lengths[first - 1] : 0;
+
+	/* old tokens that start behind the deleted bytes are the resync points */
+	k = first;
+	while (k < buf->count && buf->offsets[k] < editEnd)
+		k++;
+
+	if (!tokenBufferInit(&fresh, 64))
+		return false;
+	if (buf->symbols && !tokenBufferTrackSymbols(&fresh)) {
+		tokenBufferFree(&fresh);
+		return false;
+	}
+
+	seekPosition(lxer, restart);
+
+	for (;;) {
+		Token tok = nextToken(lxer);
+		size_t i = fresh.count;
+		long long pos = (long long)lxer->pos;
+
+		if (i == fresh.capacity && !tokenBufferReserve(&fresh, fresh.capacity * 2)) {
+			tokenBufferFree(&fresh);
+			return false;
+		}
+		fresh.types[i] = (uint8_t)tok.type;
+		fresh.offsets[i] = (uint32_t)(tok.start - lxer->input);
+		fresh.lengths[i] = (uint32_t)tok.length;
+		if (fresh.symbols)
+			fresh.symbols[i] = tok.type == TOKEN_IDEN_GENERIC ? tok.value.symbol : SYMBOL_NONE;
+		fresh.count++;
+
+		if (tok.type == TOKEN_EOF) {
+			k = buf->count;
+			break;
+		}
+
+		while (k < buf->count && (long long)buf->offsets[k] + delta < pos)
+			k++;
+		if (k < buf->count && (long long)buf->offsets[k] + delta == pos)
+			break;
+		/* with trivia skipped there are gaps, an old token end is a boundary too */
+		if (k > 0 && k < buf->count) {
+			size_t prevEnd = (size_t)buf->offsets[k - 1] + buf->lengths[k - 1];
+
+			if (prevEnd >= editEnd && (long long)prevEnd + delta == pos)
+				break;
+		}
+	}
+
+	/* splice: keep [0, first), put the fresh tokens, shift the old tail */
+	tail = buf->count - k;
+	newCount = first + fresh.count + tail;
+	if (!tokenBufferReserve(buf, newCount)) {
+		tokenBufferFree(&fresh);
+		return false;
+	}
+
+	memmove(buf->types + first + fresh.count, buf->types + k, tail);
+	memmove(buf->offsets + first + fresh.count, buf->offsets + k, tail * sizeof(uint32_t));
+	memmove(buf->lengths + first + fresh.count, buf->lengths + k, tail * sizeof(uint32_t));
+	if (buf->symbols)
+		memmove(buf->symbols + first + fresh.count, buf->symbols + k, tail * sizeof(uint32_t));
+	for (size_t i = first + fresh.count; i < newCount; i++)
+		buf->offsets[i] = (uint32_t)((long long)buf->offsets[i] + delta);
+
+	memcpy(buf->types + first, fresh.types, fresh.count);
+	memcpy(buf->offsets + first, fresh.offsets, fresh.count * sizeof(uint32_t));
+	memcpy(buf->lengths + first, fresh.lengths, fresh.count * sizeof(uint32_t));
+	if (buf->symbols)
+		memcpy(buf->symbols + first, fresh.symbols, fresh.count * sizeof(uint32_t));
+
+	if (range) {
+		range->first = first;
+		range->removed = k - first;
+		range->inserted = fresh.count;
+	}
+
+	buf->count = newCount;
+	tokenBufferFree(&fresh);
+	return true;
+}
@@ -0,0 +1,370 @@
+/******************************************************************************
+* File:        scan.c
+* Date:        03-02-26
+*
+* Description: Lexer project
+*
+* Notes: Wide scanning kernels. Every kernel reads the input in aligned
+*        16 (SSE2) or 32 (AVX2) byte blocks. An aligned block never crosses
+*        a page so reading the whole block that holds the end of the input
+*        is safe even though some of it lies past it. Bytes in front of the
+*        start pointer are masked off in the first block, bytes from end on
+*        stop the scan like a match would. There is a plain C version of
+*        each kernel for other targets.
+******************************************************************************/
+#include "scan.h"
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_BLOCK 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_BLOCK 16
+#endif
+
+/* ============================================================
+   ====================== BLOCK HELPERS =======================
+   ============================================================ */
+
+/*
+ * The aligned block holding the end of the input reaches past it by design,
+ * AddressSanitizer would flag that so the block loads are not instrumented.
+ */
+#if defined(__GNUC__)
+#define SCAN_NO_SANITIZE __attribute__((no_sanitize_address))
+#else
+#define SCAN_NO_SANITIZE
+#endif
+
+#if defined(__AVX2__)
+
+typedef __m256i ScanVec;
+
+SCAN_NO_SANITIZE
+static inline ScanVec loadBlock(const char *p)
+{
+	return _mm256_load_si256((const __m256i *)p);
+}
+
+static inline uint64_t maskEq(ScanVec v, char c)
+{
+	return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+
+/* space, or one of \t \n \v \f \r which sit together at 9..13 */
+static inline uint64_t maskSpace(ScanVec v)
+{
+	__m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+	__m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t);
+	__m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+
+	return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(ctl, sp));
+}
+
+#elif defined(__SSE2__)
+
+typedef __m128i ScanVec;
+
+SCAN_NO_SANITIZE
+static inline ScanVec loadBlock(const char *p)
+{
+	return _mm_load_si128((const __m128i *)p);
+}
+
+static inline uint64_t maskEq(ScanVec v, char c)
+{
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+/* space, or one of \t \n \v \f \r which sit together at 9..13 */
+static inline uint64_t maskSpace(ScanVec v)
+{
+	__m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+	__m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+	__m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+
+	return (uint32_t)_mm_movemask_epi8(_mm_or_si128(ctl, sp));
+}
+
+#endif
+
+#ifdef SCAN_BLOCK
+
+/* bits for the first n lanes of a block */
+static inline uint64_t lowBits(unsigned n)
+{
+	return n >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1);
+}
+
+/* lanes of the block at blk that lie at or past end */
+static inline uint64_t pastEnd(const char *blk, const char *end)
+{
+	ptrdiff_t left = end - blk;
+
+	if (left >= SCAN_BLOCK)
+		return 0;
+	return lowBits(SCAN_BLOCK) & ~(left > 0 ? lowBits((unsigned)left) : 0);
+}
+
+/*
+ * Adds the newlines set in nl to the span. base is the offset of lane 0 of
+ * the current block relative to the scan start.
+ */
+static inline void countNewlines(ScanSpan *span, uint64_t nl, ptrdiff_t base)
+{
+	if (nl) {
+		span->newlines += (size_t)__builtin_popcountll(nl);
+		span->lastNewline = (size_t)(base + 63 - __builtin_clzll(nl));
+	}
+}
+
+#endif
+
+/* ============================================================
+   ======================== KERNELS ===========================
+   ============================================================ */
+
+/*
+ * Measures the run of whitespace starting at p. Each block is classified at
+ * once, the first non-space lane ends the run and the newlines in front of
+ * it are counted with popcount.
+ */
+ScanSpan scanWhitespace(const char *p, const char *end)
+{
+	ScanSpan span = {0, 0, 0};
+
+#ifdef SCAN_BLOCK
+	unsigned lead = (unsigned)((uintptr_t)p & (SCAN_BLOCK - 1));
+	const char *blk = p - lead;
+	uint64_t skip = lowBits(lead);
+
+	for (;;) {
+		ScanVec v = loadBlock(blk);
+		uint64_t ws = maskSpace(v) | skip;
+		uint64_t nl = maskEq(v, '\n') & ~skip;
+		uint64_t stop = (~ws | pastEnd(blk, end)) & lowBits(SCAN_BLOCK);
+		ptrdiff_t base = blk - p;
+
+		if (stop) {
+			unsigned lane = (unsigned)__builtin_ctzll(stop);
+
+			countNewlines(&span, nl & lowBits(lane), base);
+			span.length = (size_t)(base + lane);
+			return span;
+		}
+
+		countNewlines(&span, nl, base);
+		blk += SCAN_BLOCK;
+		skip = 0;
+	}
+#else
+	for (; p + span.length < end; span.length++) {
+		char c = p[span.length];
+
+		if (c == '\n') {
+			span.newlines++;
+			span.lastNewline = span.length;
+		} else if (c != ' ' && (c < '\t' || c > '\r')) {
+			break;
+		}
+	}
+
+	return span;
+#endif
+}
+
+/*
+ * Measures the rest of a line comment. Each block is tested for '\n', the
+ * last one also gets the lanes past end.
+ */
+ScanSpan scanLine(const char *p, const char *end)
+{
+	ScanSpan span = {0, 0, 0};
+
+#ifdef SCAN_BLOCK
+	unsigned lead = (unsigned)((uintptr_t)p & (SCAN_BLOCK - 1));
+	const char *blk = p - lead;
+	uint64_t skip = lowBits(lead);
+
+	for (;;) {
+		ScanVec v = loadBlock(blk);
+		uint64_t stop = (maskEq(v, '\n') | pastEnd(blk, end)) & ~skip;
+
+		if (stop) {
+			span.length = (size_t)((blk - p) + __builtin_ctzll(stop));
+			return span;
+		}
+
+		blk += SCAN_BLOCK;
+		skip = 0;
+	}
+#else
+	while (p + span.length < end && p[span.length] != '\n')
+		span.length++;
+
+	return span;
+#endif
+}
+
+/*
+ * Measures a block comment body. A closing pair is a '*' lane whose next
+ * lane is '/'. Pairs inside a block come from shifting the slash mask down
+ * one lane, a pair split over two blocks is caught by carrying the star in
+ * the last lane of the previous block.
+ */
+ScanSpan scanBlockComment(const char *p, const char *end)
+{
+	ScanSpan span = {0, 0, 0};
+
+#ifdef SCAN_BLOCK
+	unsigned lead = (unsigned)((uintptr_t)p & (SCAN_BLOCK - 1));
+	const char *blk = p - lead;
+	uint64_t skip = lowBits(lead);
+	uint64_t carry = 0;
+
+	for (;;) {
+		ScanVec v = loadBlock(blk);
+		uint64_t past = pastEnd(blk, end);
+		uint64_t star = maskEq(v, '*') & ~skip;
+		uint64_t slash = maskEq(v, '/') & ~past;
+		uint64_t nl = maskEq(v, '\n') & ~skip;
+		uint64_t stop = ((star & (slash >> 1)) | past) & ~skip;
+		ptrdiff_t base = blk - p;
+
+		/* star was the last lane of the previous block */
+		if (carry && (slash & 1)) {
+			span.length = (size_t)(base - 1);
+			return span;
+		}
+
+		if (stop) {
+			unsigned lane = (unsigned)__builtin_ctzll(stop);
+
+			countNewlines(&span, nl & lowBits(lane), base);
+			span.length = (size_t)(base + lane);
+			return span;
+		}
+
+		countNewlines(&span, nl, base);
+		carry = star >> (SCAN_BLOCK - 1);
+		blk += SCAN_BLOCK;
+		skip = 0;
+	}
+#else
+	for (; p + span.length < end; span.length++) {
+		char c = p[span.length];
+
+		if (c == '*' && p + span.length + 1 < end && p[span.length + 1] == '/')
+			break;
+		if (c == '\n') {
+			span.newlines++;
+			span.lastNewline = span.length;
+		}
+	}
+
+	return span;
+#endif
+}
+
+/*
+ * Measures the escape free run of a string literal. Only the four bytes
+ * that can change the string state machine stop the scan.
+ */
+ScanSpan scanStringBody(const char *p, const char *end)
+{
+	ScanSpan span = {0, 0, 0};
+
+#ifdef SCAN_BLOCK
+	unsigned lead = (unsigned)((uintptr_t)p & (SCAN_BLOCK - 1));
+	const char *blk = p - lead;
+	uint64_t skip = lowBits(lead);
+
+	for (;;) {
+		ScanVec v = loadBlock(blk);
+		uint64_t stop = (maskEq(v, '"') | maskEq(v, '\\') |
+		                 maskEq(v, '\n') | pastEnd(blk, end)) & ~skip;
+
+		if (stop) {
+			span.length = (size_t)((blk - p) + __builtin_ctzll(stop));
+			return span;
+		}
+
+		blk += SCAN_BLOCK;
+		skip = 0;
+	}
+#else
+	for (; p + span.length < end; span.length++) {
+		char c = p[span.length];
+
+		if (c == '"' || c == '\\' || c == '\n')
+			break;
+	}
+
+	return span;
+#endif
+}
+
+/*
+ * Counts newlines over an explicit length. The first and last block are
+ * trimmed with masks so nothing outside p[0..len) is counted.
+ */
+size_t scanCountNewlines(const char *p, size_t len)
+{
+	size_t count = 0;
+
+#ifdef SCAN_BLOCK
+	unsigned lead = (unsigned)((uintptr_t)p & (SCAN_BLOCK - 1));
+	const char *blk = p - lead;
+	const char *end = p + len;
+	uint64_t skip = lowBits(lead);
+
+	for (; blk < end; blk += SCAN_BLOCK, skip = 0) {
+		uint64_t nl = maskEq(loadBlock(blk), '\n') & ~skip;
+
+		if (end - blk < SCAN_BLOCK)
+			nl &= lowBits((unsigned)(end - blk));
+		count += (size_t)__builtin_popcountll(nl);
+	}
+#else
+	for (size_t i = 0; i < len; i++)
+		count += p[i] == '\n';
+#endif
+
+	return count;
+}
+
+/*
+ * Same walk as scanCountNewlines but every set lane is turned into a line
+ * start by peeling the mask one bit at a time.
+ */
+size_t scanLineStarts(const char *p, size_t len, size_t *starts)
+{
+	size_t count = 0;
+
+#ifdef SCAN_BLOCK
+	unsigned lead = (unsigned)((uintptr_t)p & (SCAN_BLOCK - 1));
+	const char *blk = p - lead;
+	const char *end = p + len;
+	uint64_t skip = lowBits(lead);
+
+	for (; blk < end; blk += SCAN_BLOCK, skip = 0) {
+		uint64_t nl = maskEq(loadBlock(blk), '\n') & ~skip;
+
+		if (end - blk < SCAN_BLOCK)
+			nl &= lowBits((unsigned)(end - blk));
+
+		while (nl) {
+			starts[count++] = (size_t)((blk - p) + __builtin_ctzll(nl) + 1);
+			nl &= nl - 1;
+		}
+	}
+#else
+	for (size_t i = 0; i < len; i++) {
+		if (p[i] == '\n')
+			starts[count++] = i + 1;
+	}
+#endif
+
+	return count;
+}
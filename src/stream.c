@@ -0,0 +1,277 @@
+/******************************************************************************
+* File:        stream.c
+* Date:        03-09-26
+*
+* Description: Lexer project
+*
+* Notes: Streaming lexer. The stream keeps only the bytes that have not
+*        become a finished token yet. Every feed appends the chunk and lexes
+*        the buffer with the normal nextToken(). A token is only trusted if
+*        it ends before the end of the buffered bytes, because the handlers
+*        never look further than one byte past the end of a token. A token
+*        that runs into the end of the buffer (comment, string, number,
+*        ':' that could become ':=' ...) is thrown away and lexed again once
+*        more input arrives, so memory is bounded by the longest token plus
+*        one chunk instead of by the size of the input. A held back
+*        comment, string or whitespace run is only lexed again once a byte
+*        that could end it has arrived, see tailMayEnd().
+******************************************************************************/
+#include "stream.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ============================================================
+   ====================== ERROR HELPERS =======================
+   ============================================================ */
+
+/*
+ * Installed as the inner lexer's error callback. Errors are held back until
+ * we know the token they belong to is final.
+ */
+static void streamErrorTrap(int line, int col, const char *msg, void *userData, const char *errChar)
+{
+	LexerStream *stream = userData;
+
+	if (stream->pendingCount == stream->pendingCap) {
+		size_t cap = stream->pendingCap ? stream->pendingCap * 2 : 8;
+		StreamError *grown = realloc(stream->pending, cap * sizeof(*grown));
+
+		/* out of memory, drop the error rather than the token */
+		if (!grown)
+			return;
+		stream->pending = grown;
+		stream->pendingCap = cap;
+	}
+
+	stream->pending[stream->pendingCount].line = line;
+	stream->pending[stream->pendingCount].col = col;
+	stream->pending[stream->pendingCount].msg = msg;
+	stream->pending[stream->pendingCount].offset = (size_t)(errChar - stream->buffer);
+	stream->pendingCount++;
+}
+
+/*
+ * Passes the held back errors of a finished token on to the user.
+ */
+static void flushErrors(LexerStream *stream)
+{
+	if (stream->errorFn) {
+		for (size_t i = 0; i < stream->pendingCount; i++) {
+			StreamError *e = &stream->pending[i];
+
+			stream->errorFn(e->line, e->col, e->msg, stream->errorUserData,
+			                stream->buffer + e->offset);
+		}
+	}
+	stream->pendingCount = 0;
+}
+
+/* ============================================================
+   ===================== STREAM FUNCTIONS =====================
+   ============================================================ */
+
+/*
+ * Creates an empty stream that hands finished tokens to tokenFn.
+ * Set errorFn/errorUserData on the returned stream to receive errors.
+ */
+LexerStream *lexerStreamCreate(StreamTokenFn tokenFn, void *userData)
+{
+	LexerStream *stream = calloc(1, sizeof(LexerStream));
+
+	if (!stream)
+		return NULL;
+
+	stream->capacity = 256;
+	stream->buffer = malloc(stream->capacity);
+	if (!stream->buffer) {
+		free(stream);
+		return NULL;
+	}
+	stream->buffer[0] = '\0';
+
+	lexerInit(&stream->lexer, stream->buffer);
+	stream->lexer.errorFn = streamErrorTrap;
+	stream->lexer.errorUserData = stream;
+	stream->tokenFn = tokenFn;
+	stream->tokenUserData = userData;
+
+	return stream;
+}
+
+/*
+ * Frees a stream created by lexerStreamCreate.
+ */
+void lexerStreamDestroy(LexerStream *stream)
+{
+	if (!stream)
+		return;
+
+	lexerRelease(&stream->lexer);
+	free(stream->pending);
+	free(stream->buffer);
+	free(stream);
+}
+
+/*
+ * Whether the bytes fed since the held back token was last lexed could end
+ * it. Comments, strings and whitespace runs only end on a few bytes, so a
+ * long one fed in small chunks is searched for those instead of lexed again
+ * from its start every time. Anything else is just lexed again. False
+ * positives (an escaped quote) only cost a re-lex.
+ */
+static bool tailMayEnd(const LexerStream *stream)
+{
+	const char *buf = stream->buffer;
+	size_t from = stream->tailScanned;
+	size_t len = stream->length;
+
+	if (len < 2)
+		return true;
+
+	if (buf[0] == '/' && buf[1] == '/')
+		return memchr(buf + from, '\n', len - from) != NULL;
+
+	if (buf[0] == '/' && buf[1] == '*') {
+		for (size_t i = from > 2 ? from : 2; i + 1 < len; i++) {
+			if (buf[i] == '*' && buf[i + 1] == '/')
+				return true;
+		}
+		return false;
+	}
+
+	if (buf[0] == '"') {
+		for (size_t i = from > 1 ? from : 1; i < len; i++) {
+			if (buf[i] == '"' || buf[i] == '\n')
+				return true;
+		}
+		return false;
+	}
+
+	if (buf[0] == ' ' || (buf[0] >= '\t' && buf[0] <= '\r')) {
+		for (size_t i = from; i < len; i++) {
+			if (buf[i] != ' ' && (buf[i] < '\t' || buf[i] > '\r'))
+				return true;
+		}
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Lexes the buffered bytes. When final is false the token that reaches the
+ * end of the buffer is held back, lines/cols are rolled back to its start
+ * and the bytes it covers are kept for the next feed.
+ *
+ * Trivia is dropped here rather than inside nextToken() so the held back
+ * tail is always a single token that tailMayEnd() can reason about.
+ */
+static void drainBuffer(LexerStream *stream, bool final)
+{
+	LexerInfo *lxer = &stream->lexer;
+	uint64_t triviaMask = lxer->triviaMask;
+	Token tok;
+
+	lxer->input = stream->buffer;
+	lxer->length = stream->length;
+	lxer->pos = 0;
+	lxer->triviaMask = 0;
+
+	for (;;) {
+		size_t startPos = lxer->pos;
+		size_t startLines = lxer->lines;
+		size_t startCols = lxer->cols;
+		size_t startErrors = lxer->errorCount;
+		size_t startDiagnostics = lxer->diagnosticCount;
+#ifdef LEXER_STATS
+		LexerStats startStats = lxer->stats;
+#endif
+
+		stream->pendingCount = 0;
+		tok = nextToken(lxer);
+
+		/* the held back token is lexed again next time, so are its errors */
+		if (!final && (tok.type == TOKEN_EOF || lxer->pos >= stream->length)) {
+			lxer->pos = startPos;
+			lxer->lines = startLines;
+			lxer->cols = startCols;
+			lxer->errorCount = startErrors;
+			lxer->diagnosticCount = startDiagnostics;
+#ifdef LEXER_STATS
+			lxer->stats = startStats;
+#endif
+			stream->pendingCount = 0;
+			break;
+		}
+
+		flushErrors(stream);
+		if (tok.type != TOKEN_EOF && (triviaMask & LEXER_TRIVIA(tok.type))) {
+			stream->skippedTrivia += tok.length;
+			continue;
+		}
+
+		lxer->leadingTrivia = stream->skippedTrivia;
+		stream->skippedTrivia = 0;
+		if (stream->tokenFn)
+			stream->tokenFn(tok, stream->tokenUserData);
+
+		if (tok.type == TOKEN_EOF)
+			break;
+	}
+	lxer->triviaMask = triviaMask;
+
+	/* keep only the unfinished tail */
+	stream->length -= lxer->pos;
+	memmove(stream->buffer, stream->buffer + lxer->pos, stream->length + 1);
+	lxer->pos = 0;
+
+	/* the tail ran into the end, whatever ends it starts in the last bytes or later */
+	stream->tailScanned = stream->length >= 2 ? stream->length - 2 : 0;
+}
+
+/*
+ * Appends a chunk of input and emits every token it completes.
+ * Returns false if the stream is finished or the buffer could not grow.
+ */
+bool lexerFeed(LexerStream *stream, const char *chunk, size_t len)
+{
+	if (stream->finished)
+		return false;
+
+	if (stream->length + len + LEXER_PADDING > stream->capacity) {
+		size_t cap = stream->capacity;
+		char *grown;
+
+		while (stream->length + len + LEXER_PADDING > cap)
+			cap *= 2;
+		grown = realloc(stream->buffer, cap);
+		if (!grown)
+			return false;
+		stream->buffer = grown;
+		stream->capacity = cap;
+	}
+
+	memcpy(stream->buffer + stream->length, chunk, len);
+	stream->length += len;
+	stream->buffer[stream->length] = '\0';
+
+	if (tailMayEnd(stream))
+		drainBuffer(stream, false);
+	else
+		stream->tailScanned = stream->length >= 2 ? stream->length - 2 : 0;
+	return true;
+}
+
+/*
+ * Marks the end of input. Whatever is left is lexed for real, unterminated
+ * comments and strings are reported, and the EOF token is emitted.
+ */
+bool lexerFinish(LexerStream *stream)
+{
+	if (stream->finished)
+		return false;
+
+	drainBuffer(stream, true);
+	stream->finished = true;
+	return true;
+}
@@ -3,10 +3,23 @@
 * Description: Unit tests for nextToken() using Unity framework
 ******************************************************************************/
 
+#define _DEFAULT_SOURCE
+
 #include <unity.h>
 #include "lexer.h"
 #include "hash.h"
+#include "stream.h"
+#include "parallel.h"
+#include "relex.h"
+#include "intern.h"
+#include "arena.h"
+#include "cache.h"
+#include "batch.h"
 #include <string.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
 
 /* ======================
    Unity Hooks
@@ -56,81 +69,1353 @@ void test_perfectHash(void)
            "MANIFEST"
        };
    
-       Keyword hash = perfectHash(keyWords[0], strlen(keyWords[0]));
+       Keyword hash = lookUp(keyWords[0], strlen(keyWords[0]));
        TEST_ASSERT_EQUAL(hash, KEYWRD_LET);
+
+       for (size_t i = 0; i < sizeof(keyWords) / sizeof(keyWords[0]); i++)
+           TEST_ASSERT_TRUE(lookUp(keyWords[i], strlen(keyWords[i])) != KEYWRD_NONE);
+
+       TEST_ASSERT_EQUAL(KEYWRD_MANIFEST, lookUp("MANIFEST", 8));
+       TEST_ASSERT_EQUAL(KEYWRD_NONE, lookUp("TESTING", 7));
+       TEST_ASSERT_EQUAL(KEYWRD_NONE, lookUp("LETS", 4));
+       TEST_ASSERT_EQUAL(KEYWRD_NONE, lookUp("let", 3));
+       /* only the first len bytes take part in the compare */
+       TEST_ASSERT_EQUAL(KEYWRD_LET, lookUp("LETX", 3));
    }
    
+void test_nextToken_keyword_id(void)
+{
+    LexerInfo *lx = lexerCreate("RESULTIS x");
 
+    Token tok = nextToken(lx);
+
+    assertTokenType(&tok, TOKEN_KEYWORD);
+    TEST_ASSERT_EQUAL(KEYWRD_RESULTIS, tok.keyword);
+
+    nextToken(lx);
+    tok = nextToken(lx);
+    assertTokenType(&tok, TOKEN_IDEN_GENERIC);
+    TEST_ASSERT_EQUAL(KEYWRD_NONE, tok.keyword);
+
+    lexerDestroy(lx);
+}
 
 
 void test_nextToken_semicolon(void)
 {
     LexerInfo *lx = lexerCreate(";");
 
-    Token *tok = nextToken(lx);
+    Token tok = nextToken(lx);
 
-    assertTokenType(tok, TOKEN_SEMICOL);
-    TEST_ASSERT_EQUAL(';', tok->value);
+    assertTokenType(&tok, TOKEN_SEMICOL);
+    TEST_ASSERT_EQUAL(';', *tok.start);
+
+    lexerDestroy(lx);
 }
 
 
 void test_stringHandler_basic(void) {
-    LexerInfo lx = { "\"hello\"", 0 };
+    LexerInfo *lx = lexerCreate("\"hello\"");
 
-    Token *tok = stringHandler(&lx);
+    Token tok = stringHandler(lx);
 
-    TEST_ASSERT_NOT_NULL(tok);               // Should not be NULL
-    TEST_ASSERT_EQUAL(TOKEN_STRING, tok->type); // Type should be TOKEN_STRING
-    TEST_ASSERT_NOT_NULL(tok->stringVal);    // stringVal should not be NULL
-    TEST_ASSERT_EQUAL_STRING("hello", tok->stringVal); // stringVal matches input
+    TEST_ASSERT_EQUAL(TOKEN_STRING, tok.type); // Type should be TOKEN_STRING
+    TEST_ASSERT_EQUAL(7, tok.length);          // quotes are part of the token
+    TEST_ASSERT_EQUAL_STRING_LEN("\"hello\"", tok.start, tok.length);
 
-    free(tok->stringVal);
-    free(tok);
+    lexerDestroy(lx);
 }
 
 void test_stringHandler_empty_string(void) {
-    LexerInfo lx = { "\"\"", 0 };
+    LexerInfo *lx = lexerCreate("\"\"");
 
-    Token *tok = stringHandler(&lx);
+    Token tok = stringHandler(lx);
 
-    TEST_ASSERT_NOT_NULL(tok);
-    TEST_ASSERT_EQUAL(TOKEN_STRING, tok->type);
-    TEST_ASSERT_NOT_NULL(tok->stringVal);
-    TEST_ASSERT_EQUAL_STRING("", tok->stringVal);
+    /* empty strings are reported as an error */
+    TEST_ASSERT_EQUAL(TOKEN_ERR, tok.type);
+    TEST_ASSERT_EQUAL(2, tok.length);
 
-    free(tok->stringVal);
-    free(tok);
+    lexerDestroy(lx);
 }
 
 void test_stringHandler_long_string(void) {
-    // This string will trigger buffer resizing
+    // Long enough to cross several scan blocks
     char longInput[200];
     for (int i = 0; i < 199; i++) longInput[i] = 'a';
     longInput[199] = '\0';
 
-    char buffer[201];
+    char buffer[202];
     snprintf(buffer, sizeof(buffer), "\"%s\"", longInput);
 
-    LexerInfo lx = { buffer, 0 };
+    LexerInfo *lx = lexerCreate(buffer);
+
+    Token tok = stringHandler(lx);
+
+    TEST_ASSERT_EQUAL(TOKEN_STRING, tok.type);
+    TEST_ASSERT_EQUAL(201, tok.length);
+    TEST_ASSERT_EQUAL_STRING_LEN(longInput, tok.start + 1, 199);
+
+    lexerDestroy(lx);
+}
+
+/*
+ * 64 byte aligned so the scan kernels' 16 and 32 byte blocks start at known
+ * offsets of the input.
+ */
+static _Alignas(64) char scanBuf[256 + LEXER_PADDING];
+
+void test_blockComment_block_boundaries(void)
+{
+    /* the closing "*" "/" slides over every offset of the first few blocks */
+    for (size_t star = 2; star < 100; star++) {
+        for (int fill = 0; fill < 4; fill++) {
+            bool newline = fill == 2 && star > 2;
+            LexerInfo lxer;
+            Token tok;
+
+            memset(scanBuf, 0, sizeof(scanBuf));
+            memcpy(scanBuf, "/*", 2);
+            for (size_t i = 2; i < star; i++) {
+                /* runs of stars and stars right in front of a block end must not close it */
+                scanBuf[i] = fill == 1 || (fill == 3 && i % 2) ? '*' : 'a';
+            }
+            if (newline)
+                scanBuf[star - 1] = '\n';
+            memcpy(scanBuf + star, "*/ x", 4);
+
+            lexerInit(&lxer, scanBuf);
+            tok = nextToken(&lxer);
+            assertTokenType(&tok, TOKEN_COMMENT);
+            TEST_ASSERT_EQUAL(star + 2, tok.length);
+            TEST_ASSERT_EQUAL(newline ? 2 : 1, lxer.lines);
+            TEST_ASSERT_EQUAL(newline ? 2 : star + 2, lxer.cols);
+
+            nextToken(&lxer);
+            tok = nextToken(&lxer);
+            TEST_ASSERT_EQUAL_STRING_LEN("x", tok.start, tok.length);
+            TEST_ASSERT_EQUAL(star + 3, (size_t)(tok.start - scanBuf));
+            lexerRelease(&lxer);
+        }
+    }
+}
+
+void test_nextToken_positions_after_runs(void)
+{
+    /* offset, length and lines/cols after each token, worked out by hand */
+    static const size_t want[][4] = {
+        {  0,   2, 1,  2},  /* ab                         */
+        {  2,   1, 1,  3},
+        {  3,  14, 3,  6},  /* comment over three lines   */
+        { 17, 143, 4, 42},  /* 100 spaces, \n\t\t, 40 more */
+        {160,   1, 4, 43},  /* c                          */
+        {161,  73, 7, 70},  /* \n\n\n and 70 spaces       */
+        {234,   1, 7, 71},  /* d                          */
+        {235,   1, 7, 71},  /* EOF                        */
+    };
+    size_t len = 0;
+
+    memset(scanBuf, 0, sizeof(scanBuf));
+    len += (size_t)sprintf(scanBuf + len, "ab /* 1\n22\n333 */");
+    memset(scanBuf + len, ' ', 100);
+    len += 100;
+    len += (size_t)sprintf(scanBuf + len, "\n\t\t");
+    memset(scanBuf + len, ' ', 40);
+    len += 40;
+    len += (size_t)sprintf(scanBuf + len, "c\n\n\n");
+    memset(scanBuf + len, ' ', 70);
+    len += 70;
+    scanBuf[len++] = 'd';
+
+    for (int engine = 0; engine < 2; engine++) {
+        LexerInfo lxer;
+
+        lexerInit(&lxer, scanBuf);
+        lxer.tableDriven = engine;
+        for (size_t i = 0; i < sizeof(want) / sizeof(want[0]); i++) {
+            Token tok = nextToken(&lxer);
+
+            TEST_ASSERT_EQUAL(want[i][0], (size_t)(tok.start - scanBuf));
+            TEST_ASSERT_EQUAL(want[i][1], tok.length);
+            TEST_ASSERT_EQUAL(want[i][2], lxer.lines);
+            TEST_ASSERT_EQUAL(want[i][3], lxer.cols);
+        }
+        lexerRelease(&lxer);
+    }
+}
+
+void test_lexerInitSpan_ends_mid_block(void)
+{
+    /* what would end each run sits right past the end of the span */
+    for (size_t cut = 0; cut < 80; cut++) {
+        LexerInfo lxer;
+        Token tok;
+
+        memset(scanBuf, 0, sizeof(scanBuf));
+        memcpy(scanBuf, "/*", 2);
+        memset(scanBuf + 2, 'a', cut);
+        memcpy(scanBuf + 2 + cut, "*/", 2);
+        lexerInitSpan(&lxer, scanBuf, 2 + cut);
+        lxer.bufferDiagnostics = true;
+        tok = nextToken(&lxer);
+        assertTokenType(&tok, TOKEN_ERR);
+        TEST_ASSERT_EQUAL(2 + cut, tok.length);
+        TEST_ASSERT_EQUAL(1, lxer.errorCount);
+        TEST_ASSERT_EQUAL(2 + cut, lxer.cols);
+        lexerRelease(&lxer);
+
+        scanBuf[1] = '/';
+        scanBuf[2 + cut] = '\n';
+        lexerInitSpan(&lxer, scanBuf, 2 + cut);
+        tok = nextToken(&lxer);
+        assertTokenType(&tok, TOKEN_COMMENT);
+        TEST_ASSERT_EQUAL(2 + cut, tok.length);
+        TEST_ASSERT_EQUAL(1, lxer.lines);
+        tok = nextToken(&lxer);
+        assertTokenType(&tok, TOKEN_EOF);
+        lexerRelease(&lxer);
+
+        memset(scanBuf, ' ', 2 + cut);
+        scanBuf[0] = 'x';
+        memcpy(scanBuf + 1 + cut, "\n y", 3);
+        lexerInitSpan(&lxer, scanBuf, 1 + cut);
+        nextToken(&lxer);
+        tok = nextToken(&lxer);
+        if (cut) {
+            assertTokenType(&tok, TOKEN_DELIM_S);
+            TEST_ASSERT_EQUAL(cut, tok.length);
+            tok = nextToken(&lxer);
+        }
+        assertTokenType(&tok, TOKEN_EOF);
+        TEST_ASSERT_EQUAL(1 + cut, (size_t)(tok.start - scanBuf));
+        TEST_ASSERT_EQUAL(1, lxer.lines);
+        TEST_ASSERT_EQUAL(1 + cut, lxer.cols);
+        lexerRelease(&lxer);
+    }
+}
+
+void test_lexerTokenizeBatch_columns(void)
+{
+    LexerInfo *lx = lexerCreate("LET x := 10");
+    LexerInfo big;
+    TokenBuffer buf;
+    const uint8_t types[] = {TOKEN_KEYWORD, TOKEN_DELIM_S, TOKEN_IDEN_GENERIC, TOKEN_DELIM_S,
+                             TOKEN_ASSIGN, TOKEN_DELIM_S, TOKEN_INT, TOKEN_EOF};
+    const uint32_t offsets[] = {0, 3, 4, 5, 6, 8, 9, 11};
+    const uint32_t lengths[] = {3, 1, 1, 1, 2, 1, 2};
+
+    TEST_ASSERT_TRUE(tokenBufferInit(&buf, 2));
+
+    /* batches stop at maxTokens and right after EOF, growing the columns */
+    TEST_ASSERT_EQUAL(3, lexerTokenizeBatch(lx, &buf, 3));
+    TEST_ASSERT_EQUAL(5, lexerTokenizeBatch(lx, &buf, 100));
+    TEST_ASSERT_EQUAL(8, buf.count);
+    TEST_ASSERT_TRUE(buf.capacity >= 8);
+    TEST_ASSERT_EQUAL_MEMORY(types, buf.types, 8);
+    TEST_ASSERT_EQUAL_MEMORY(offsets, buf.offsets, sizeof(offsets));
+    TEST_ASSERT_EQUAL_MEMORY(lengths, buf.lengths, sizeof(lengths));
+    TEST_ASSERT_NULL(buf.symbols);
+
+    /* offsets are 32 bit, a bigger input is refused before anything is lexed */
+    lexerInitSpan(&big, "x", (size_t)UINT32_MAX + 1);
+    TEST_ASSERT_EQUAL(0, lexerTokenizeAll(&big, &buf));
+    TEST_ASSERT_EQUAL(0, lexerTokenizeBatch(&big, &buf, 1));
+    TEST_ASSERT_EQUAL(8, buf.count);
+    TEST_ASSERT_EQUAL(0, big.pos);
+    lexerRelease(&big);
+
+    tokenBufferFree(&buf);
+    TEST_ASSERT_EQUAL(0, buf.count);
+    lexerDestroy(lx);
+}
+
+static void countErrorLines(int line, int col, const char *message, void *userData, const char *errChar)
+{
+    int *lines = userData;
+
+    (void)col;
+    (void)message;
+    (void)errChar;
+    lines[lines[0]++ + 1] = line;
+}
+
+/* records what the stream emits so it can be checked against nextToken() */
+typedef struct {
+    TokenType types[64];
+    size_t lengths[64];
+    size_t count;
+} StreamLog;
+
+static void logStreamToken(Token tok, void *userData)
+{
+    StreamLog *log = userData;
+
+    if (log->count < 64) {
+        log->types[log->count] = tok.type;
+        log->lengths[log->count] = tok.length;
+    }
+    log->count++;
+}
+
+void test_lexerFeed_split_tokens(void)
+{
+    /* every token here gets cut by the 3 byte chunks at least once */
+    const char *src = "LET x := y->z /* a\n b */ \"s\\\"t\" 0x1F 1.25 // c\n";
+    LexerInfo *lx = lexerCreate(src);
+    StreamLog log = {0};
+    LexerStream *stream = lexerStreamCreate(logStreamToken, &log);
+    size_t len = strlen(src);
+    size_t count = 0;
+    Token tok;
+
+    for (size_t i = 0; i < len; i += 3)
+        TEST_ASSERT_TRUE(lexerFeed(stream, src + i, len - i < 3 ? len - i : 3));
+    TEST_ASSERT_TRUE(lexerFinish(stream));
+
+    do {
+        tok = nextToken(lx);
+        TEST_ASSERT_EQUAL(tok.type, log.types[count]);
+        TEST_ASSERT_EQUAL(tok.length, log.lengths[count]);
+        count++;
+    } while (tok.type != TOKEN_EOF);
+
+    TEST_ASSERT_EQUAL(count, log.count);
+    TEST_ASSERT_EQUAL(lx->lines, stream->lexer.lines);
+    TEST_ASSERT_EQUAL(lx->cols, stream->lexer.cols);
+
+    lexerStreamDestroy(stream);
+    lexerDestroy(lx);
+}
+
+void test_lexerFeed_long_tokens(void)
+{
+    /* long comments, strings and blank runs held back over many small feeds */
+    const size_t run = 16 * 1024;
+    const size_t chunks[] = {1, 5, 4096};
+    char *src = malloc(5 * run + 64);
+    size_t len = 0;
+
+    TEST_ASSERT_NOT_NULL(src);
+    len += (size_t)sprintf(src + len, "x /*");
+    memset(src + len, '*', run);
+    len += run;
+    len += (size_t)sprintf(src + len, "*/ y \"");
+    memset(src + len, 's', run);
+    len += run;
+    len += (size_t)sprintf(src + len, "\" //");
+    memset(src + len, 'c', run);
+    len += run;
+    src[len++] = '\n';
+    memset(src + len, ' ', run);
+    len += run;
+    len += (size_t)sprintf(src + len, "z :=");
+    src[len] = '\0';
+
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        LexerInfo *lx = lexerCreate(src);
+        StreamLog log = {0};
+        LexerStream *stream = lexerStreamCreate(logStreamToken, &log);
+        size_t count = 0;
+        Token tok;
+
+        /* half the runs are trivia, the stream has to skip them like nextToken */
+        lx->triviaMask = c == 1 ? LEXER_TRIVIA_DEFAULT : 0;
+        stream->lexer.triviaMask = lx->triviaMask;
+
+        for (size_t i = 0; i < len; i += chunks[c])
+            TEST_ASSERT_TRUE(lexerFeed(stream, src + i, len - i < chunks[c] ? len - i : chunks[c]));
+        TEST_ASSERT_TRUE(lexerFinish(stream));
+
+        do {
+            tok = nextToken(lx);
+            TEST_ASSERT_EQUAL(tok.type, log.types[count]);
+            TEST_ASSERT_EQUAL(tok.length, log.lengths[count]);
+            count++;
+        } while (tok.type != TOKEN_EOF);
+
+        TEST_ASSERT_EQUAL(count, log.count);
+        TEST_ASSERT_EQUAL(lx->lines, stream->lexer.lines);
+        TEST_ASSERT_EQUAL(lx->cols, stream->lexer.cols);
 
-    Token *tok = stringHandler(&lx);
+        lexerStreamDestroy(stream);
+        lexerDestroy(lx);
+    }
+    free(src);
+}
+
+void test_lexerFeed_max_errors(void)
+{
+    /* a held back token must not count its errors again on every re-lex */
+    const char *src = "0b12345 a\n0b19 b\n";
+    LexerInfo *lx = lexerCreate(src);
+    StreamLog log = {0};
+    LexerStream *stream = lexerStreamCreate(logStreamToken, &log);
+    int want[16] = {0}, got[16] = {0};
+    size_t count = 0;
+    Token tok;
+
+    lx->maxErrors = 2;
+    lx->errorFn = countErrorLines;
+    lx->errorUserData = want;
+    stream->lexer.maxErrors = 2;
+    stream->errorFn = countErrorLines;
+    stream->errorUserData = got;
+
+    for (size_t i = 0; src[i]; i++)
+        TEST_ASSERT_TRUE(lexerFeed(stream, src + i, 1));
+    TEST_ASSERT_TRUE(lexerFinish(stream));
+
+    do {
+        tok = nextToken(lx);
+        TEST_ASSERT_EQUAL(tok.type, log.types[count]);
+        TEST_ASSERT_EQUAL(tok.length, log.lengths[count]);
+        count++;
+    } while (tok.type != TOKEN_EOF);
+
+    TEST_ASSERT_EQUAL(count, log.count);
+    TEST_ASSERT_EQUAL(2, lx->errorCount);
+    TEST_ASSERT_EQUAL(lx->errorCount, stream->lexer.errorCount);
+    TEST_ASSERT_EQUAL(want[0], got[0]);
+    TEST_ASSERT_EQUAL_MEMORY(want, got, sizeof(want));
+
+    lexerStreamDestroy(stream);
+    lexerDestroy(lx);
+}
+
+void test_lexerTokenizeParallel_matches_sequential(void)
+{
+    /* big enough to be split 4 ways, a comment is left open across every cut */
+    const char *unit = "LET a := 1 /* spans\nlines */ WRITEF(\"%n\", a)\n";
+    size_t unitLen = strlen(unit);
+    size_t reps = 4 * LEXER_PARALLEL_MIN_SEGMENT / unitLen + 1;
+    char *src = malloc(reps * unitLen + 1);
+    TokenBuffer seq, par;
+
+    TEST_ASSERT_NOT_NULL(src);
+    for (size_t i = 0; i < reps; i++)
+        memcpy(src + i * unitLen, unit, unitLen);
+    src[reps * unitLen] = '\0';
+
+    LexerInfo *a = lexerCreate(src);
+    LexerInfo *b = lexerCreate(src);
+    tokenBufferInit(&seq, 0);
+    tokenBufferInit(&par, 0);
+
+    lexerTokenizeAll(a, &seq);
+    lexerTokenizeParallel(b, &par, 4);
+
+    TEST_ASSERT_EQUAL(seq.count, par.count);
+    TEST_ASSERT_EQUAL_MEMORY(seq.types, par.types, seq.count);
+    TEST_ASSERT_EQUAL_MEMORY(seq.offsets, par.offsets, seq.count * sizeof(uint32_t));
+    TEST_ASSERT_EQUAL_MEMORY(seq.lengths, par.lengths, seq.count * sizeof(uint32_t));
+    TEST_ASSERT_EQUAL(a->lines, b->lines);
+    TEST_ASSERT_EQUAL(a->cols, b->cols);
+
+    tokenBufferFree(&seq);
+    tokenBufferFree(&par);
+    lexerDestroy(a);
+    lexerDestroy(b);
+    free(src);
+}
+
+void test_lexerTokenizeParallel_buffered_errors(void)
+{
+    /* errors on both sides of cuts that land inside comments and strings */
+    const char *unit = "LET a := 0123 /* x\n*/ b := '' \"s\\\nt\" 'ab'\n";
+    size_t unitLen = strlen(unit);
+    size_t reps = 4 * LEXER_PARALLEL_MIN_SEGMENT / unitLen + 1;
+    char *src = malloc(reps * unitLen + 1);
+    TokenBuffer seq, par;
+
+    TEST_ASSERT_NOT_NULL(src);
+    for (size_t i = 0; i < reps; i++)
+        memcpy(src + i * unitLen, unit, unitLen);
+    src[reps * unitLen] = '\0';
+
+    LexerInfo *a = lexerCreate(src);
+    LexerInfo *b = lexerCreate(src);
+    a->bufferDiagnostics = true;
+    b->bufferDiagnostics = true;
+    tokenBufferInit(&seq, 0);
+    tokenBufferInit(&par, 0);
+
+    lexerTokenizeAll(a, &seq);
+    lexerTokenizeParallel(b, &par, 4);
+
+    TEST_ASSERT_EQUAL(seq.count, par.count);
+    TEST_ASSERT_EQUAL_MEMORY(seq.types, par.types, seq.count);
+    TEST_ASSERT_EQUAL(3 * reps, a->errorCount);
+    TEST_ASSERT_EQUAL(a->errorCount, b->errorCount);
+    TEST_ASSERT_EQUAL(a->diagnosticCount, b->diagnosticCount);
+    for (size_t i = 0; i < a->diagnosticCount; i++) {
+        TEST_ASSERT_EQUAL(a->diagnostics[i].offset, b->diagnostics[i].offset);
+        TEST_ASSERT_EQUAL(a->diagnostics[i].code, b->diagnostics[i].code);
+    }
+    TEST_ASSERT_EQUAL(a->lines, b->lines);
+    TEST_ASSERT_EQUAL(a->cols, b->cols);
+
+    tokenBufferFree(&seq);
+    tokenBufferFree(&par);
+    lexerDestroy(a);
+    lexerDestroy(b);
+    free(src);
+}
+
+/* re-lexes after an edit and checks the result against lexing from scratch */
+static void assertRelexMatches(const char *before, const char *after, size_t editOffset,
+                               size_t deletedLen, size_t insertedLen, size_t maxInserted)
+{
+    LexerInfo *lx = lexerCreate(before);
+    LexerInfo *fresh = lexerCreate(after);
+    TokenBuffer buf, want;
+    RelexRange range;
+
+    tokenBufferInit(&buf, 0);
+    tokenBufferInit(&want, 0);
+    lexerTokenizeAll(lx, &buf);
+    lexerTokenizeAll(fresh, &want);
+
+    lx->input = after;
+    TEST_ASSERT_TRUE(lexerRelex(lx, &buf, editOffset, deletedLen, insertedLen, &range));
+
+    TEST_ASSERT_EQUAL(want.count, buf.count);
+    TEST_ASSERT_EQUAL_MEMORY(want.types, buf.types, want.count);
+    TEST_ASSERT_EQUAL_MEMORY(want.offsets, buf.offsets, want.count * sizeof(uint32_t));
+    TEST_ASSERT_EQUAL_MEMORY(want.lengths, buf.lengths, want.count * sizeof(uint32_t));
+    TEST_ASSERT_TRUE(range.inserted <= maxInserted);
+
+    tokenBufferFree(&buf);
+    tokenBufferFree(&want);
+    lexerDestroy(lx);
+    lexerDestroy(fresh);
+}
+
+void test_lexerRelex_edits(void)
+{
+    /* renaming an identifier only touches that token */
+    assertRelexMatches("LET a := 1\nLET b := 2\nLET c := 3\n",
+                       "LET abc := 1\nLET b := 2\nLET c := 3\n", 5, 0, 2, 1);
+    /* ':' next to the edit becomes ':=' */
+    assertRelexMatches("x : y", "x := y", 3, 0, 1, 2);
+    /* opening a comment swallows everything up to the next close */
+    assertRelexMatches("a b c */ d e", "a /*b c */ d e", 2, 0, 2, 2);
+    /* closing it again splits the tokens back out */
+    assertRelexMatches("a /*b c */ d e", "a b c */ d e", 2, 2, 0, 8);
+    /* an unterminated string runs to the end of the input */
+    assertRelexMatches("WRITEF(x)\nLET y", "WRITEF(\"x)\nLET y", 7, 0, 1, 16);
+}
+
+void test_lexerResolvePosition_lazy(void)
+{
+    const char *src = "LET a = 1\n\n  /* x\ny */ b\n";
+    LexerInfo *eager = lexerCreate(src);
+    LexerInfo *lazy = lexerCreate(src);
+    size_t line, col;
+    Token tok;
+
+    lazy->lazyPositions = true;
+
+    do {
+        tok = nextToken(eager);
+        nextToken(lazy);
+        TEST_ASSERT_TRUE(lexerResolvePosition(lazy, lazy->pos, &line, &col));
+        TEST_ASSERT_EQUAL(eager->lines, line);
+        TEST_ASSERT_EQUAL(eager->cols, col);
+    } while (tok.type != TOKEN_EOF);
+
+    /* lazy mode never touches the counters */
+    TEST_ASSERT_EQUAL(1, lazy->lines);
+    TEST_ASSERT_EQUAL(0, lazy->cols);
+    TEST_ASSERT_EQUAL(5, lazy->lineCount);
+
+    lexerDestroy(eager);
+    lexerDestroy(lazy);
+}
+
+void test_numHandler_decodeLiterals(void)
+{
+    LexerInfo *lxer = lexerCreate("1234567890123 0xDEADbeef12 0b101 0o777 12.5 9999999999999999999999999999");
+    Token tok;
+
+    lxer->decodeLiterals = true;
+
+    tok = nextToken(lxer);
+    TEST_ASSERT_EQUAL(TOKEN_INT, tok.type);
+    TEST_ASSERT_TRUE(tok.value.intVal == 1234567890123ULL);
+    nextToken(lxer);
+    tok = nextToken(lxer);
+    TEST_ASSERT_EQUAL(TOKEN_HEX, tok.type);
+    TEST_ASSERT_TRUE(tok.value.intVal == 0xDEADBEEF12ULL);
+    nextToken(lxer);
+    tok = nextToken(lxer);
+    TEST_ASSERT_TRUE(tok.value.intVal == 5);
+    nextToken(lxer);
+    tok = nextToken(lxer);
+    TEST_ASSERT_TRUE(tok.value.intVal == 0777);
+    nextToken(lxer);
+    tok = nextToken(lxer);
+    TEST_ASSERT_EQUAL(TOKEN_FLOAT, tok.type);
+    TEST_ASSERT_TRUE(tok.value.floatVal == 12.5);
+    TEST_ASSERT_EQUAL(0, tok.flags);
+    nextToken(lxer);
+    tok = nextToken(lxer);
+    TEST_ASSERT_EQUAL(TOKEN_INT, tok.type);
+    TEST_ASSERT_TRUE(tok.flags & TOKEN_FLAG_OVERFLOW);
+
+    lexerDestroy(lxer);
+}
+
+void test_identHandler_interned_symbols(void)
+{
+    InternTable *table = internCreate(0);
+    LexerInfo *a = lexerCreate("alpha beta LET alpha");
+    LexerInfo *b = lexerCreate("beta gamma");
+    Token ta[4], tb[2];
+    size_t len;
+
+    a->symbols = table;
+    b->symbols = table;
+
+    for (int i = 0; i < 4; i++) {
+        ta[i] = nextToken(a);
+        nextToken(a);
+    }
+    for (int i = 0; i < 2; i++) {
+        tb[i] = nextToken(b);
+        nextToken(b);
+    }
+
+    TEST_ASSERT_EQUAL(TOKEN_IDEN_GENERIC, ta[0].type);
+    TEST_ASSERT_NOT_EQUAL(SYMBOL_NONE, ta[0].value.symbol);
+    TEST_ASSERT_EQUAL(ta[0].value.symbol, ta[3].value.symbol);
+    TEST_ASSERT_EQUAL(ta[1].value.symbol, tb[0].value.symbol);
+    TEST_ASSERT_NOT_EQUAL(ta[0].value.symbol, ta[1].value.symbol);
+    TEST_ASSERT_EQUAL(TOKEN_KEYWORD, ta[2].type);
+    TEST_ASSERT_EQUAL(3, internCount(table));
+    TEST_ASSERT_EQUAL_STRING("gamma", internName(table, tb[1].value.symbol, &len));
+    TEST_ASSERT_EQUAL(5, len);
+    TEST_ASSERT_EQUAL(tb[1].value.symbol, intern(table, "gamma", 5));
+
+    lexerDestroy(a);
+    lexerDestroy(b);
+    internDestroy(table);
+}
+
+/* interns every name of a shared list, starting at a different place per thread */
+typedef struct {
+    InternTable *table;
+    size_t names;
+    size_t first;
+    uint32_t *ids;
+} InternWork;
+
+static void *internAll(void *arg)
+{
+    InternWork *w = arg;
+    char name[16];
+
+    for (size_t i = 0; i < w->names; i++) {
+        size_t n = (w->first + i) % w->names;
+        int len = snprintf(name, sizeof(name), "n%zu", n);
+
+        w->ids[n] = intern(w->table, name, (size_t)len);
+    }
+    return NULL;
+}
+
+void test_intern_grows_past_buckets(void)
+{
+    /* 64 times the default bucket count, added from 4 threads at once */
+    enum { NAMES = 64 * 1024, THREADS = 4 };
+    InternTable *table = internCreate(0);
+    InternWork work[THREADS];
+    pthread_t tids[THREADS];
+    char name[16];
+    size_t len;
+
+    for (size_t t = 0; t < THREADS; t++) {
+        work[t].table = table;
+        work[t].names = NAMES;
+        work[t].first = t * NAMES / THREADS;
+        work[t].ids = malloc(NAMES * sizeof(uint32_t));
+        TEST_ASSERT_NOT_NULL(work[t].ids);
+        TEST_ASSERT_EQUAL(0, pthread_create(&tids[t], NULL, internAll, &work[t]));
+    }
+    for (size_t t = 0; t < THREADS; t++)
+        pthread_join(tids[t], NULL);
+
+    TEST_ASSERT_EQUAL(NAMES, internCount(table));
+    for (size_t n = 0; n < NAMES; n++) {
+        int want = snprintf(name, sizeof(name), "n%zu", n);
+
+        TEST_ASSERT_NOT_EQUAL(SYMBOL_NONE, work[0].ids[n]);
+        for (size_t t = 1; t < THREADS; t++)
+            TEST_ASSERT_EQUAL(work[0].ids[n], work[t].ids[n]);
+        TEST_ASSERT_EQUAL(work[0].ids[n], intern(table, name, (size_t)want));
+        TEST_ASSERT_EQUAL_STRING(name, internName(table, work[0].ids[n], &len));
+        TEST_ASSERT_EQUAL(want, len);
+    }
+
+    for (size_t t = 0; t < THREADS; t++)
+        free(work[t].ids);
+    internDestroy(table);
+}
+
+void test_lexerReset_reuses_context(void)
+{
+    Arena arena;
+    LexerInfo lxer;
+    TokenBuffer buf;
+    Token tok;
+
+    arenaInit(&arena, 0);
+    lexerInit(&lxer, "a := 1\nb");
+    TEST_ASSERT_TRUE(tokenBufferInitArena(&buf, &arena, 4));
+    lexerTokenizeAll(&lxer, &buf);
+    TEST_ASSERT_EQUAL(8, buf.count);
+    TEST_ASSERT_EQUAL(2, lxer.lines);
+
+    /* same context, new input, starts over at line 1 */
+    lexerReset(&lxer, "LET x");
+    TEST_ASSERT_EQUAL(1, lxer.lines);
+    tok = nextToken(&lxer);
+    TEST_ASSERT_EQUAL(TOKEN_KEYWORD, tok.type);
+    TEST_ASSERT_EQUAL_STRING_LEN("LET", tok.start, 3);
+
+    /* the whole batch of token columns goes back in one go */
+    arenaReset(&arena);
+    TEST_ASSERT_TRUE(tokenBufferInitArena(&buf, &arena, 1024));
+    TEST_ASSERT_EQUAL(0, buf.count);
+
+    lexerRelease(&lxer);
+    arenaFree(&arena);
+}
+
+void test_lexerGetStats(void)
+{
+    LexerInfo lxer;
+    LexerStats stats;
+    Token tok;
+
+    lexerInit(&lxer, "ab cd");
+    do {
+        tok = nextToken(&lxer);
+    } while (tok.type != TOKEN_EOF);
+
+#ifdef LEXER_STATS
+    TEST_ASSERT_TRUE(lexerGetStats(&lxer, &stats));
+    TEST_ASSERT_EQUAL(2, stats.tokens[TOKEN_IDEN_GENERIC]);
+    TEST_ASSERT_EQUAL(1, stats.tokens[TOKEN_EOF]);
+    TEST_ASSERT_EQUAL(2, stats.branchTokens[LEXER_BRANCH_IDENT]);
+    TEST_ASSERT_EQUAL(4, stats.branchBytes[LEXER_BRANCH_IDENT]);
+    TEST_ASSERT_EQUAL(1, stats.branchBytes[LEXER_BRANCH_DELIM]);
+
+    lexerResetStats(&lxer);
+    lexerGetStats(&lxer, &stats);
+    TEST_ASSERT_EQUAL(0, stats.tokens[TOKEN_IDEN_GENERIC]);
+#else
+    /* compiled out, the call still links and reports nothing */
+    TEST_ASSERT_FALSE(lexerGetStats(&lxer, &stats));
+    TEST_ASSERT_EQUAL(0, stats.tokens[TOKEN_IDEN_GENERIC]);
+#endif
+
+    lexerRelease(&lxer);
+}
+
+void test_lexerFlushDiagnostics_error_limit(void)
+{
+    LexerInfo lxer;
+    Token tok;
+    int lines[8] = {0};
+
+    lexerInit(&lxer, "`\n``` x\ny");
+    lxer.errorFn = countErrorLines;
+    lxer.errorUserData = lines;
+    lxer.bufferDiagnostics = true;
+    lxer.maxErrors = 2;
+
+    tok = nextToken(&lxer);
+    assertTokenType(&tok, TOKEN_ERR);
+    nextToken(&lxer);
+    tok = nextToken(&lxer);
+    TEST_ASSERT_EQUAL(1, tok.length);
+
+    /* third error is past the limit, the rest of the line goes in one token */
+    tok = nextToken(&lxer);
+    assertTokenType(&tok, TOKEN_ERR);
+    TEST_ASSERT_EQUAL_STRING_LEN("`` x", tok.start, tok.length);
+    tok = nextToken(&lxer);
+    assertTokenType(&tok, TOKEN_DELIM_N);
+
+    /* nothing is delivered until the flush, and only up to the limit */
+    TEST_ASSERT_EQUAL(0, lines[0]);
+    TEST_ASSERT_EQUAL(3, lxer.errorCount);
+    TEST_ASSERT_EQUAL(2, lexerFlushDiagnostics(&lxer));
+    TEST_ASSERT_EQUAL(2, lines[0]);
+    TEST_ASSERT_EQUAL(1, lines[1]);
+    TEST_ASSERT_EQUAL(2, lines[2]);
+    TEST_ASSERT_EQUAL(0, lxer.diagnosticCount);
+
+    lexerRelease(&lxer);
+}
+
+void test_nextToken_trivia_mask(void)
+{
+    LexerInfo lxer;
+    Token tok;
+
+    lexerInit(&lxer, "a /* c */ b // d\nc");
+    lxer.triviaMask = LEXER_TRIVIA_DEFAULT;
+
+    tok = nextToken(&lxer);
+    TEST_ASSERT_EQUAL_STRING_LEN("a", tok.start, tok.length);
+    TEST_ASSERT_EQUAL(0, lxer.leadingTrivia);
+
+    /* the comment and both spaces are skipped but measured */
+    tok = nextToken(&lxer);
+    TEST_ASSERT_EQUAL_STRING_LEN("b", tok.start, tok.length);
+    TEST_ASSERT_EQUAL(9, lxer.leadingTrivia);
+
+    tok = nextToken(&lxer);
+    TEST_ASSERT_EQUAL_STRING_LEN("c", tok.start, tok.length);
+    TEST_ASSERT_EQUAL(6, lxer.leadingTrivia);
+    TEST_ASSERT_EQUAL(2, lxer.lines);
+
+    tok = nextToken(&lxer);
+    assertTokenType(&tok, TOKEN_EOF);
+    lexerRelease(&lxer);
+}
+
+void test_tokenCache_roundtrip(void)
+{
+    char dir[] = "/tmp/lexcacheXXXXXX";
+    TokenCache *cache;
+    TokenCacheKey key;
+    LexerInfo lxer;
+    TokenBuffer lexed, loaded;
+
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    cache = tokenCacheOpen(dir, 0);
+    TEST_ASSERT_NOT_NULL(cache);
+
+    lexerInit(&lxer, "LET x := 1\ny");
+    tokenBufferInit(&lexed, 0);
+    tokenCacheKeyFor(&lxer, &key);
+    TEST_ASSERT_FALSE(tokenCacheLoad(cache, &key, &lxer, &lexed));
+    lexerTokenizeAll(&lxer, &lexed);
+    TEST_ASSERT_TRUE(tokenCacheStore(cache, &key, &lxer, &lexed));
+
+    /* the same text again comes back from the cache without lexing */
+    lexerReset(&lxer, "LET x := 1\ny");
+    tokenBufferInit(&loaded, 0);
+    tokenCacheKeyFor(&lxer, &key);
+    TEST_ASSERT_TRUE(tokenCacheLoad(cache, &key, &lxer, &loaded));
+    TEST_ASSERT_EQUAL(lexed.count, loaded.count);
+    TEST_ASSERT_EQUAL_MEMORY(lexed.types, loaded.types, lexed.count);
+    TEST_ASSERT_EQUAL_MEMORY(lexed.offsets, loaded.offsets, lexed.count * sizeof(uint32_t));
+    TEST_ASSERT_EQUAL_MEMORY(lexed.lengths, loaded.lengths, lexed.count * sizeof(uint32_t));
+    TEST_ASSERT_EQUAL(2, lxer.lines);
+
+    /* growing it moves the columns out of the mapping */
+    TEST_ASSERT_TRUE(tokenBufferReserve(&loaded, loaded.count + 1));
+    TEST_ASSERT_NULL(loaded.mapping);
+
+    /* edited text is a different entry */
+    lexerReset(&lxer, "LET x := 2\ny");
+    tokenCacheKeyFor(&lxer, &key);
+    TEST_ASSERT_FALSE(tokenCacheLoad(cache, &key, &lxer, &loaded));
+
+    tokenBufferFree(&lexed);
+    tokenBufferFree(&loaded);
+    tokenCacheClose(cache);
+
+    /* reopened with a tiny limit every entry is trimmed away */
+    tokenCacheClose(tokenCacheOpen(dir, 1));
+    TEST_ASSERT_EQUAL(0, rmdir(dir));
+    lexerRelease(&lxer);
+}
+
+void test_tokenCache_rejects_mismatches(void)
+{
+    char dir[] = "/tmp/lexcacheXXXXXX";
+    char path[4096] = "";
+    TokenCache *cache;
+    TokenCacheKey key;
+    LexerInfo lxer;
+    TokenBuffer lexed, loaded;
+    struct dirent *ent;
+    DIR *d;
+    FILE *f;
+    uint32_t bad = 1000;
+
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    cache = tokenCacheOpen(dir, 0);
+    TEST_ASSERT_NOT_NULL(cache);
+
+    lexerInit(&lxer, "LET x := 1\ny");
+    tokenBufferInit(&lexed, 0);
+    tokenBufferInit(&loaded, 0);
+    tokenCacheKeyFor(&lxer, &key);
+    lexerTokenizeAll(&lxer, &lexed);
+    TEST_ASSERT_TRUE(tokenCacheStore(cache, &key, &lxer, &lexed));
+
+    /* an eager entry is not handed to a lazy lexer */
+    lexerReset(&lxer, "LET x := 1\ny");
+    lxer.lazyPositions = true;
+    tokenCacheKeyFor(&lxer, &key);
+    TEST_ASSERT_FALSE(tokenCacheLoad(cache, &key, &lxer, &loaded));
+
+    /* an entry with a token past the end of the input is a miss */
+    d = opendir(dir);
+    TEST_ASSERT_NOT_NULL(d);
+    while ((ent = readdir(d)) != NULL) {
+        if (strstr(ent->d_name, ".tok"))
+            snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    }
+    closedir(d);
+    f = fopen(path, "r+b");
+    TEST_ASSERT_NOT_NULL(f);
+    /* the offsets column starts right after the 80 byte header */
+    TEST_ASSERT_EQUAL(0, fseek(f, 80, SEEK_SET));
+    TEST_ASSERT_EQUAL(1, fwrite(&bad, sizeof(bad), 1, f));
+    fclose(f);
+
+    lexerReset(&lxer, "LET x := 1\ny");
+    lxer.lazyPositions = false;
+    tokenCacheKeyFor(&lxer, &key);
+    TEST_ASSERT_FALSE(tokenCacheLoad(cache, &key, &lxer, &loaded));
+    TEST_ASSERT_EQUAL(0, lxer.pos);
+
+    tokenBufferFree(&lexed);
+    tokenBufferFree(&loaded);
+    tokenCacheClose(cache);
+    tokenCacheClose(tokenCacheOpen(dir, 1));
+    TEST_ASSERT_EQUAL(0, rmdir(dir));
+    lexerRelease(&lxer);
+}
+
+/* one lexBatchRun call, so two of them can run side by side */
+typedef struct {
+    BatchFile *files;
+    size_t count;
+    unsigned threads;
+    bool keepInput;
+    InternTable *symbols;
+    bool ok;
+} BatchJob;
+
+static void *runBatch(void *arg)
+{
+    BatchJob *job = arg;
+
+    job->ok = lexBatchRun(job->files, job->count, job->threads, job->keepInput,
+                          job->symbols, 0, NULL);
+    return NULL;
+}
+
+void test_lexBatchRun_matches_sequential(void)
+{
+    /* files of different sizes so the workers have to steal from each other */
+    enum { FILES = 9 };
+    const char *unit = "LET a := 0123 /* c */ WRITEF(\"%n\", a)\n";
+    char dir[] = "/tmp/lexbatchXXXXXX";
+    char paths[FILES][64];
+    BatchFile a[FILES], b[FILES];
+    BatchJob ja = {a, FILES, 3, false, NULL, false};
+    BatchJob jb = {b, FILES, 4, true, NULL, false};
+    pthread_t tid;
+
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    for (size_t i = 0; i < FILES; i++) {
+        FILE *f;
+
+        snprintf(paths[i], sizeof(paths[i]), "%s/f%zu.b", dir, i);
+        f = fopen(paths[i], "w");
+        TEST_ASSERT_NOT_NULL(f);
+        for (size_t r = 0; r < (i * 7 % FILES + 1) * 200; r++)
+            fputs(unit, f);
+        fclose(f);
+        memset(&a[i], 0, sizeof(a[i]));
+        memset(&b[i], 0, sizeof(b[i]));
+        a[i].path = paths[i];
+        b[i].path = paths[i];
+    }
+
+    /* two batches at once must not share any scheduling state */
+    jb.symbols = internCreate(0);
+    TEST_ASSERT_EQUAL(0, pthread_create(&tid, NULL, runBatch, &ja));
+    runBatch(&jb);
+    pthread_join(tid, NULL);
+    TEST_ASSERT_TRUE(ja.ok);
+    TEST_ASSERT_TRUE(jb.ok);
+
+    for (size_t i = 0; i < FILES; i++) {
+        LexerInfo *lx = lexerCreateFromFile(paths[i]);
+        TokenBuffer want;
+
+        TEST_ASSERT_NOT_NULL(lx);
+        tokenBufferInit(&want, 0);
+        lexerTokenizeAll(lx, &want);
+
+        for (int k = 0; k < 2; k++) {
+            const BatchFile *got = k ? &b[i] : &a[i];
+
+            TEST_ASSERT_TRUE(got->ok);
+            TEST_ASSERT_EQUAL(want.count, got->tokens.count);
+            TEST_ASSERT_EQUAL_MEMORY(want.types, got->tokens.types, want.count);
+            TEST_ASSERT_EQUAL_MEMORY(want.offsets, got->tokens.offsets, want.count * sizeof(uint32_t));
+            TEST_ASSERT_EQUAL_MEMORY(want.lengths, got->tokens.lengths, want.count * sizeof(uint32_t));
+            TEST_ASSERT_EQUAL(lx->lines, got->lines);
+            TEST_ASSERT_EQUAL(lx->cols, got->cols);
+            TEST_ASSERT_EQUAL(lx->errorCount, got->errors);
+        }
+        TEST_ASSERT_NOT_NULL(b[i].lexer);
+        TEST_ASSERT_NOT_NULL(b[i].tokens.symbols);
+
+        tokenBufferFree(&want);
+        lexerDestroy(lx);
+        TEST_ASSERT_EQUAL(0, unlink(paths[i]));
+    }
+
+    lexBatchFree(a, FILES);
+    lexBatchFree(b, FILES);
+    internDestroy(jb.symbols);
+    TEST_ASSERT_EQUAL(0, rmdir(dir));
+}
+
+void test_lexerCreateFromFile_mapped(void)
+{
+    /*
+     * empty file, a file that ends exactly on a page boundary and one that
+     * does not, the last two are big enough to be mapped. Each ends in an
+     * identifier so the scanner reads the padding behind the last byte.
+     */
+    const char *unit = "LET a := 12 /* c */ WRITEF(\"%n\", a)\n";
+    long page = sysconf(_SC_PAGESIZE);
+    size_t mapped = ((64 * 1024 + (size_t)page - 1) / (size_t)page) * (size_t)page;
+    size_t sizes[] = {0, mapped, mapped + 1234};
+    char dir[] = "/tmp/lexmapXXXXXX";
+    char path[64];
+
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    snprintf(path, sizeof(path), "%s/f.b", dir);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t size = sizes[i], unitLen = strlen(unit), used = 0;
+        char *bytes = malloc(size + 1);
+        LexerInfo *fromFile, *fromString;
+        TokenBuffer got, want;
+        FILE *f;
+
+        TEST_ASSERT_NOT_NULL(bytes);
+        while (used + unitLen + 8 <= size) {
+            memcpy(bytes + used, unit, unitLen);
+            used += unitLen;
+        }
+        memset(bytes + used, 'x', size - used);
+        bytes[size] = '\0';
+
+        f = fopen(path, "wb");
+        TEST_ASSERT_NOT_NULL(f);
+        TEST_ASSERT_EQUAL(size, fwrite(bytes, 1, size, f));
+        fclose(f);
+
+        fromFile = lexerCreateFromFile(path);
+        fromString = lexerCreate(bytes);
+        TEST_ASSERT_NOT_NULL(fromFile);
+        TEST_ASSERT_NOT_NULL(fromString);
+        TEST_ASSERT_EQUAL(size, fromFile->length);
+        if (size)
+            TEST_ASSERT_NOT_EQUAL(0, fromFile->mappedSize);
+
+        tokenBufferInit(&got, 0);
+        tokenBufferInit(&want, 0);
+        lexerTokenizeAll(fromFile, &got);
+        lexerTokenizeAll(fromString, &want);
+
+        TEST_ASSERT_EQUAL(want.count, got.count);
+        TEST_ASSERT_EQUAL_MEMORY(want.types, got.types, want.count);
+        TEST_ASSERT_EQUAL_MEMORY(want.offsets, got.offsets, want.count * sizeof(uint32_t));
+        TEST_ASSERT_EQUAL_MEMORY(want.lengths, got.lengths, want.count * sizeof(uint32_t));
+        TEST_ASSERT_EQUAL(fromString->lines, fromFile->lines);
+        TEST_ASSERT_EQUAL(fromString->cols, fromFile->cols);
+        TEST_ASSERT_EQUAL(0, fromFile->errorCount);
+        if (size) {
+            /* the trailing identifier runs right up to the end of the file */
+            TEST_ASSERT_EQUAL(TOKEN_IDEN_GENERIC, got.types[got.count - 2]);
+            TEST_ASSERT_EQUAL(size, got.offsets[got.count - 2] + got.lengths[got.count - 2]);
+        }
+
+        tokenBufferFree(&got);
+        tokenBufferFree(&want);
+        lexerDestroy(fromFile);
+        lexerDestroy(fromString);
+        free(bytes);
+    }
+
+    TEST_ASSERT_EQUAL(0, unlink(path));
+    TEST_ASSERT_EQUAL(0, rmdir(dir));
+}
+
+void test_peekToken_mark_rewind(void)
+{
+    LexerInfo lxer;
+    LexerMark mark;
+    Token ahead, tok;
+
+    lexerInit(&lxer, "a ` b\nc");
+    lxer.triviaMask = LEXER_TRIVIA_DEFAULT;
+    lxer.bufferDiagnostics = true;
+
+    /* peeking lexes ahead without moving the lexer */
+    ahead = peekToken(&lxer, 2);
+    TEST_ASSERT_EQUAL_STRING_LEN("b", ahead.start, ahead.length);
+    TEST_ASSERT_EQUAL(0, lxer.pos);
+    tok = nextToken(&lxer);
+    TEST_ASSERT_EQUAL_STRING_LEN("a", tok.start, tok.length);
+
+    /* a rewind hands out the same tokens again */
+    mark = lexerMark(&lxer);
+    tok = nextToken(&lxer);
+    assertTokenType(&tok, TOKEN_ERR);
+    tok = nextToken(&lxer);
+    TEST_ASSERT_TRUE(tok.start == ahead.start);
+    tok = nextToken(&lxer);
+    TEST_ASSERT_EQUAL_STRING_LEN("c", tok.start, tok.length);
+    TEST_ASSERT_EQUAL(2, lxer.lines);
+
+    lexerRewind(&lxer, mark);
+    TEST_ASSERT_EQUAL(1, lxer.pos);
+    TEST_ASSERT_EQUAL(1, lxer.lines);
+    tok = nextToken(&lxer);
+    assertTokenType(&tok, TOKEN_ERR);
+    TEST_ASSERT_EQUAL(1, lxer.leadingTrivia);
+
+    /* the bad token was only lexed once */
+    TEST_ASSERT_EQUAL(1, lxer.errorCount);
+    lexerRelease(&lxer);
+}
+
+void test_lexTable_matches_lexToken(void)
+{
+    const char *input = "x := a->b => c << 2 >= d ~= e; /* c */ f(\"s\", 'c', 1.5) & `\n";
+    LexerInfo hand, table;
+    Token a, b;
+
+    lexerInit(&hand, input);
+    lexerInit(&table, input);
+    hand.bufferDiagnostics = table.bufferDiagnostics = true;
+    table.tableDriven = true;
+
+    /* both engines produce the same stream, operators in one lookup */
+    do {
+        a = nextToken(&hand);
+        b = nextToken(&table);
+        TEST_ASSERT_EQUAL(a.type, b.type);
+        TEST_ASSERT_TRUE(a.start == b.start);
+        TEST_ASSERT_EQUAL(a.length, b.length);
+        TEST_ASSERT_EQUAL(hand.cols, table.cols);
+    } while (a.type != TOKEN_EOF);
+
+    TEST_ASSERT_EQUAL(hand.lines, table.lines);
+    TEST_ASSERT_EQUAL(1, table.errorCount);
+    lexerRelease(&hand);
+    lexerRelease(&table);
+
+    lexerInit(&table, ":=");
+    table.tableDriven = true;
+    a = nextToken(&table);
+    assertTokenType(&a, TOKEN_ASSIGN);
+    TEST_ASSERT_EQUAL(2, a.length);
+    lexerRelease(&table);
+}
+
+void test_lexerCreateFromSpan_bounds(void)
+{
+    /* the slice "x := y" sits in a bigger buffer with no '\0' after it */
+    char text[6 + 4 + LEXER_PADDING] = "x := y<=zz";
+    const char nul[3 + LEXER_PADDING] = "a\0b";
+    LexerInfo *lx = lexerCreateFromSpan(text, 6);
+    Token tok;
+
+    nextToken(lx);
+    nextToken(lx);
+    tok = nextToken(lx);
+    assertTokenType(&tok, TOKEN_ASSIGN);
+    nextToken(lx);
+    tok = nextToken(lx);
+    TEST_ASSERT_EQUAL_STRING_LEN("y", tok.start, tok.length);
+    tok = nextToken(lx);
+    assertTokenType(&tok, TOKEN_EOF);
+    TEST_ASSERT_EQUAL(6, lx->pos);
+    lexerDestroy(lx);
+
+    /* an embedded NUL is reported and lexing goes on past it */
+    lx = lexerCreateFromSpan(nul, 3);
+    lx->bufferDiagnostics = true;
+    nextToken(lx);
+    tok = nextToken(lx);
+    assertTokenType(&tok, TOKEN_ERR);
+    tok = nextToken(lx);
+    TEST_ASSERT_EQUAL_STRING_LEN("b", tok.start, tok.length);
+    TEST_ASSERT_EQUAL(1, lx->errorCount);
+    TEST_ASSERT_EQUAL(LEX_ERR_EMBEDDED_NUL, lx->diagnostics[0].code);
+    lexerDestroy(lx);
+}
+
+/* counts tokens and the batches they came in, stops after stopAfter batches */
+typedef struct {
+    size_t tokens;
+    size_t batches;
+    size_t idents;
+    size_t stopAfter;
+    TokenType last;
+} SinkTally;
+
+static bool tallySink(const Token *tokens, size_t count, void *userData)
+{
+    SinkTally *t = userData;
+
+    TEST_ASSERT_TRUE(count > 0 && count <= LEXER_SINK_BATCH);
+    for (size_t i = 0; i < count; i++)
+        t->idents += tokens[i].type == TOKEN_IDEN_GENERIC;
+    t->tokens += count;
+    t->last = tokens[count - 1].type;
+    return ++t->batches != t->stopAfter;
+}
+
+void test_lexerRun_sinks(void)
+{
+    /* 600 identifiers with the spaces skipped is three batches, EOF in the last */
+    char text[600 * 2 + 1];
+    SinkTally a = {0}, b = {0};
+    LexerInfo *lx;
+
+    for (size_t i = 0; i < 600; i++) {
+        text[i * 2] = 'a';
+        text[i * 2 + 1] = ' ';
+    }
+    text[600 * 2] = '\0';
+
+    lx = lexerCreate(text);
+    lx->triviaMask = LEXER_TRIVIA(TOKEN_DELIM_S);
+    TEST_ASSERT_TRUE(lexerAddSink(lx, tallySink, &a));
+    TEST_ASSERT_TRUE(lexerAddSink(lx, tallySink, &b));
+    TEST_ASSERT_EQUAL(601, lexerRun(lx));
+    TEST_ASSERT_EQUAL(3, a.batches);
+    TEST_ASSERT_EQUAL(601, a.tokens);
+    TEST_ASSERT_EQUAL(600, a.idents);
+    TEST_ASSERT_EQUAL(TOKEN_EOF, a.last);
+    TEST_ASSERT_EQUAL(a.tokens, b.tokens);
+
+    /* a sink returning false ends the run after that batch */
+    lexerReset(lx, text);
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    b.stopAfter = 1;
+    TEST_ASSERT_EQUAL(LEXER_SINK_BATCH, lexerRun(lx));
+    TEST_ASSERT_EQUAL(1, a.batches);
+    TEST_ASSERT_EQUAL(TOKEN_IDEN_GENERIC, a.last);
+
+    for (size_t i = 2; i < LEXER_MAX_SINKS; i++)
+        TEST_ASSERT_TRUE(lexerAddSink(lx, tallySink, &a));
+    TEST_ASSERT_FALSE(lexerAddSink(lx, tallySink, &a));
+    lexerDestroy(lx);
+}
+
+/* tokens and errors in the order they were handed out, 'E' marks an error */
+typedef struct {
+    char events[64];
+    size_t count;
+    size_t stopAt;      /* stop the first time this many events are in */
+} EventLog;
+
+static void logErrorEvent(int line, int col, const char *msg, void *userData, const char *errChar)
+{
+    EventLog *log = userData;
+
+    (void)line; (void)col; (void)msg; (void)errChar;
+    if (log->count < sizeof(log->events))
+        log->events[log->count++] = 'E';
+}
+
+static bool logSinkEvents(const Token *tokens, size_t count, void *userData)
+{
+    EventLog *log = userData;
+
+    for (size_t i = 0; i < count && log->count < sizeof(log->events); i++)
+        log->events[log->count++] = tokens[i].type == TOKEN_ERR ? 'e' : 't';
+    if (log->stopAt && log->count >= log->stopAt) {
+        log->stopAt = 0;
+        return false;
+    }
+    return true;
+}
+
+void test_lexerRun_error_order(void)
+{
+    const char *src = "a 0123 b '' c";
+    LexerInfo *lx = lexerCreate(src);
+    EventLog want = {0}, got = {0};
+    Token tok;
 
-    TEST_ASSERT_NOT_NULL(tok);
-    TEST_ASSERT_EQUAL(TOKEN_STRING, tok->type);
-    TEST_ASSERT_NOT_NULL(tok->stringVal);
-    TEST_ASSERT_EQUAL_STRING(longInput, tok->stringVal);
+    /* what a nextToken() loop reports */
+    lx->errorFn = logErrorEvent;
+    lx->errorUserData = &want;
+    lx->triviaMask = LEXER_TRIVIA_DEFAULT;
+    do {
+        tok = nextToken(lx);
+        logSinkEvents(&tok, 1, &want);
+    } while (tok.type != TOKEN_EOF);
 
-    free(tok->stringVal);
-    free(tok);
+    /* each error comes right before its token, also when a sink stops there */
+    lexerReset(lx, src);
+    lx->errorUserData = &got;
+    got.stopAt = 1;
+    TEST_ASSERT_TRUE(lexerAddSink(lx, logSinkEvents, &got));
+    TEST_ASSERT_FALSE(lexerDrive(lx, NULL));
+    TEST_ASSERT_EQUAL_STRING_LEN("t", got.events, got.count);
+    lexerRun(lx);
+    TEST_ASSERT_EQUAL(want.count, got.count);
+    TEST_ASSERT_EQUAL_STRING_LEN("tEetEett", want.events, 8);
+    TEST_ASSERT_EQUAL_STRING_LEN(want.events, got.events, want.count);
+    lexerDestroy(lx);
 }
 
 int main(void)
 {
     UNITY_BEGIN();
     RUN_TEST(test_perfectHash);
-    //RUN_TEST(test_stringHandler_basic);
-    //RUN_TEST(test_stringHandler_empty_string);
-    //RUN_TEST(test_stringHandler_long_string);
-    //RUN_TEST(test_nextToken_semicolon);
+    RUN_TEST(test_nextToken_keyword_id);
+    RUN_TEST(test_stringHandler_basic);
+    RUN_TEST(test_stringHandler_empty_string);
+    RUN_TEST(test_stringHandler_long_string);
+    RUN_TEST(test_blockComment_block_boundaries);
+    RUN_TEST(test_nextToken_positions_after_runs);
+    RUN_TEST(test_lexerInitSpan_ends_mid_block);
+    RUN_TEST(test_nextToken_semicolon);
+    RUN_TEST(test_lexerTokenizeBatch_columns);
+    RUN_TEST(test_lexerFeed_split_tokens);
+    RUN_TEST(test_lexerFeed_long_tokens);
+    RUN_TEST(test_lexerFeed_max_errors);
+    RUN_TEST(test_lexerTokenizeParallel_matches_sequential);
+    RUN_TEST(test_lexerTokenizeParallel_buffered_errors);
+    RUN_TEST(test_lexerRelex_edits);
+    RUN_TEST(test_lexerResolvePosition_lazy);
+    RUN_TEST(test_numHandler_decodeLiterals);
+    RUN_TEST(test_identHandler_interned_symbols);
+    RUN_TEST(test_intern_grows_past_buckets);
+    RUN_TEST(test_lexerReset_reuses_context);
+    RUN_TEST(test_lexerGetStats);
+    RUN_TEST(test_lexerFlushDiagnostics_error_limit);
+    RUN_TEST(test_nextToken_trivia_mask);
+    RUN_TEST(test_tokenCache_roundtrip);
+    RUN_TEST(test_tokenCache_rejects_mismatches);
+    RUN_TEST(test_lexBatchRun_matches_sequential);
+    RUN_TEST(test_lexerCreateFromFile_mapped);
+    RUN_TEST(test_peekToken_mark_rewind);
+    RUN_TEST(test_lexTable_matches_lexToken);
+    RUN_TEST(test_lexerCreateFromSpan_bounds);
+    RUN_TEST(test_lexerRun_sinks);
+    RUN_TEST(test_lexerRun_error_order);
     return UNITY_END();
 }
\ No newline at end of file
@@ -0,0 +1,220 @@
+/******************************************************************************
+* File:        gentables.c
+* Date:        05-11-26
+*
+* Description: Lexer project
+*
+* Notes: Build time generator for the tables of the table driven engine
+*        (lexTable() in lexer.c). The operator and punctuation spellings
+*        come from TOKEN_LIST so adding an operator there is all it takes.
+*        Writes a header with
+*          lexClass    the state a token starting with each byte is lexed in
+*          lexOpIndex  a small index per operator byte, 0 for the rest
+*          lexOpPair   the token for the first two bytes of an operator,
+*                      maximal munch resolved ahead of time
+*
+*        usage: gentables output.h
+******************************************************************************/
+#include "lexer.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* the states lexTable() dispatches on, in the order they are numbered */
+static const char *classNames[] = {
+    "LEX_CLASS_ERR", "LEX_CLASS_EOF", "LEX_CLASS_SPACE", "LEX_CLASS_DIGIT",
+    "LEX_CLASS_DOT", "LEX_CLASS_IDENT", "LEX_CLASS_SLASH", "LEX_CLASS_OP",
+    "LEX_CLASS_STRING", "LEX_CLASS_CHAR"
+};
+
+enum { CLS_ERR, CLS_EOF, CLS_SPACE, CLS_DIGIT, CLS_DOT, CLS_IDENT, CLS_SLASH, CLS_OP,
+       CLS_STRING, CLS_CHAR, CLS_COUNT };
+
+/*
+ * Operator bytes without a spelling of their own. lexToken() sends them to
+ * opHandler() which has no case for them, they come out as one byte of
+ * TOKEN_UNKNOWN without an error.
+ */
+#define RESERVED_OPS "&|"
+
+/* bit set in a lexOpPair entry when both bytes belong to the operator */
+#define OP_LONG 0x80
+
+static const char *spellings[TOKEN_COUNT] = {
+    #define X(name, spelling) [name] = spelling,
+        TOKEN_LIST
+    #undef X
+};
+
+static const char *typeNames[TOKEN_COUNT] = {
+    #define X(name, spelling) [name] = #name,
+        TOKEN_LIST
+    #undef X
+};
+
+static uint8_t classes[256];
+static uint8_t opIndex[256];
+static unsigned char opChars[64];
+static size_t opCount = 1;          /* index 0 is every byte that isn't one */
+static uint8_t opPair[64][64];
+
+static bool addOpChar(unsigned char c)
+{
+	if (opIndex[c])
+		return true;
+	if (opCount == sizeof(opChars)) {
+		fprintf(stderr, "gentables: too many operator bytes\n");
+		return false;
+	}
+	opIndex[c] = (uint8_t)opCount;
+	opChars[opCount++] = c;
+	classes[c] = c == '/' ? CLS_SLASH : CLS_OP;
+	return true;
+}
+
+/* ============================================================
+   ========================= TABLES ===========================
+   ============================================================ */
+
+/*
+ * Classifies every byte the way the tests at the top of lexToken() do,
+ * then gives every byte used in a spelling an operator index.
+ */
+static bool buildClasses(void)
+{
+	for (int c = 0; c < 256; c++) {
+		if (c == ' ' || (c >= '\t' && c <= '\r'))
+			classes[c] = CLS_SPACE;
+		else if (c >= '0' && c <= '9')
+			classes[c] = CLS_DIGIT;
+		else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+			classes[c] = CLS_IDENT;
+	}
+	classes['\0'] = CLS_EOF;
+	classes['.'] = CLS_DOT;
+	classes['"'] = CLS_STRING;
+	classes['\''] = CLS_CHAR;
+
+	for (int t = 0; t < TOKEN_COUNT; t++) {
+		if (!spellings[t])
+			continue;
+		for (const char *s = spellings[t]; *s; s++) {
+			if (!addOpChar((unsigned char)*s))
+				return false;
+		}
+	}
+	for (const char *s = RESERVED_OPS; *s; s++) {
+		if (!addOpChar((unsigned char)*s))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Fills lexOpPair. A row starts out as the one byte token of its first
+ * byte, then every two byte spelling overrides its column. Fails when a
+ * spelling can't be expressed or a one byte token is missing.
+ */
+static bool buildPairs(void)
+{
+	for (size_t i = 1; i < opCount; i++) {
+		int single = strchr(RESERVED_OPS, opChars[i]) ? TOKEN_UNKNOWN : -1;
+
+		for (int t = 0; t < TOKEN_COUNT; t++) {
+			if (spellings[t] && spellings[t][0] == (char)opChars[i] && !spellings[t][1])
+				single = t;
+		}
+		if (single < 0) {
+			fprintf(stderr, "gentables: no one byte token for '%c'\n", opChars[i]);
+			return false;
+		}
+		for (size_t j = 0; j < opCount; j++)
+			opPair[i][j] = (uint8_t)single;
+	}
+
+	for (int t = 0; t < TOKEN_COUNT; t++) {
+		const char *s = spellings[t];
+
+		if (!s || !s[1])
+			continue;
+		if (s[2]) {
+			fprintf(stderr, "gentables: %s is longer than two bytes\n", typeNames[t]);
+			return false;
+		}
+		opPair[opIndex[(unsigned char)s[0]]][opIndex[(unsigned char)s[1]]] = (uint8_t)(t | OP_LONG);
+	}
+	return true;
+}
+
+/* ============================================================
+   ========================== OUTPUT ==========================
+   ============================================================ */
+
+static void writeBytes(FILE *out, const uint8_t *bytes, size_t n, size_t perLine)
+{
+	for (size_t i = 0; i < n; i++) {
+		fprintf(out, "%s0x%02x,", i % perLine ? " " : "    ", bytes[i]);
+		if (i % perLine == perLine - 1 || i == n - 1)
+			fputc('\n', out);
+	}
+}
+
+static void writeHeader(FILE *out)
+{
+	fprintf(out, "/* generated by tools/gentables.c from TOKEN_LIST, do not edit */\n");
+	fprintf(out, "#ifndef LEXTABLES_H\n#define LEXTABLES_H\n\n");
+
+	fprintf(out, "enum {\n");
+	for (size_t i = 0; i < CLS_COUNT; i++)
+		fprintf(out, "    %s,\n", classNames[i]);
+	fprintf(out, "    LEX_CLASS_COUNT\n};\n\n");
+
+	fprintf(out, "#define LEX_OP_COUNT %zu\n", opCount);
+	fprintf(out, "#define LEX_OP_LONG  0x%02x\n\n", OP_LONG);
+
+	fprintf(out, "static const uint8_t lexClass[256] = {\n");
+	writeBytes(out, classes, 256, 16);
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "static const uint8_t lexOpIndex[256] = {\n");
+	writeBytes(out, opIndex, 256, 16);
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "static const uint8_t lexOpPair[LEX_OP_COUNT][LEX_OP_COUNT] = {\n");
+	for (size_t i = 0; i < opCount; i++) {
+		if (i)
+			fprintf(out, "    /* '%c' */\n", opChars[i]);
+		else
+			fprintf(out, "    /* not an operator */\n");
+		fprintf(out, "    {\n");
+		writeBytes(out, opPair[i], opCount, 12);
+		fprintf(out, "    },\n");
+	}
+	fprintf(out, "};\n\n#endif /* LEXTABLES_H */\n");
+}
+
+int main(int argc, char **argv)
+{
+	FILE *out;
+
+	_Static_assert(TOKEN_COUNT < OP_LONG, "token types have to fit next to OP_LONG");
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s output.h\n", argv[0]);
+		return 1;
+	}
+
+	if (!buildClasses() || !buildPairs())
+		return 1;
+
+	out = fopen(argv[1], "w");
+	if (!out) {
+		fprintf(stderr, "gentables: cannot open %s\n", argv[1]);
+		return 1;
+	}
+	writeHeader(out);
+	if (fclose(out) != 0) {
+		remove(argv[1]);
+		return 1;
+	}
+	return 0;
+}